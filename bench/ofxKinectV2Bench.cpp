@@ -0,0 +1,344 @@
+//
+//  ofxKinectV2Bench.cpp
+//  kinectExample
+//
+//  Console benchmark for the ofxKinectV2 kernels. Needs no device and no openFrameworks, every section runs on
+//  synthetic frames and checks the SIMD paths against the scalar reference before timing them.
+//
+//  build from this folder, the defines stand in for the windows export.h bundled with libfreenect2:
+//    g++ -O2 -std=c++11 -pthread -I../src -I../libs/libfreenect2/include -DLIBFREENECT2_STATIC_DEFINE
+//        -DLIBFREENECT2_DEPRECATED= ofxKinectV2Bench.cpp ../src/ofxKinectV2Kernels.cpp
+//        ../src/ofxKinectV2DepthProcessor.cpp ../src/ofxKinectV2Registration.cpp -o ofxKinectV2Bench
+//
+//  run all sections, or only the ones named on the command line:
+//    ./ofxKinectV2Bench [swizzle] [downscale] [depth] [threads] [tables] [--packets=<recording>]
+//
+//  threads decodes the synthetic depth packet, or the packets of a recording made with
+//  ofxKinectV2::recordDepthPackets() when one is given.
+//
+//  exits with 1 when any path does not match its reference.
+//
+
+#include "ofxKinectV2Kernels.h"
+#include "ofxKinectV2DepthProcessor.h"
+#include "ofxKinectV2Registration.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace ofxKinectV2Kernels;
+
+namespace {
+
+	bool bFailed = false;
+	const char* packetPath = nullptr;
+
+	// mean ms per call over enough calls to fill about half a second, after one warm up call
+	double timeMs(const std::function<void()>& fn)
+	{
+		fn();
+		auto start = std::chrono::steady_clock::now();
+		int count = 0;
+		double elapsed = 0;
+		do {
+			fn();
+			count++;
+			elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		} while (elapsed < 500 && count < 1000);
+		return elapsed / count;
+	}
+
+	void check(const char* what, bool ok)
+	{
+		if (!ok)
+		{
+			printf("  MISMATCH: %s\n", what);
+			bFailed = true;
+		}
+	}
+
+	// runs fn once per simd level the cpu supports, with the kernels forced down to that level
+	void forEachLevel(const std::function<void(SimdLevel)>& fn)
+	{
+		SimdLevel best = getSimdLevel();
+		for (int level = SIMD_SCALAR; level <= best; level++)
+		{
+			setSimdLevel((SimdLevel)level);
+			fn((SimdLevel)level);
+		}
+		setSimdLevel(best);
+	}
+
+	void fillNoise(uint8_t* data, size_t size, uint32_t seed)
+	{
+		for (size_t i = 0; i < size; i++)
+		{
+			seed = seed * 1664525 + 1013904223;
+			data[i] = (uint8_t)(seed >> 24);
+		}
+	}
+
+	//--------------------------------------------------------------
+	// user-001: the per frame BGRX to RGBA copy of the 1920x1080 color frame. the legacy path is what the worker
+	// did before, ofPixels::setFromPixels (a memcpy) followed by a getPixelsIter loop that swaps bytes 0 and 2
+	void benchSwizzle()
+	{
+		const size_t numPixels = 1920 * 1080;
+		std::vector<uint8_t> src(numPixels * 4), legacy(numPixels * 4), dst(numPixels * 4);
+		fillNoise(src.data(), src.size(), 1);
+
+		double legacyMs = timeMs([&] {
+			memcpy(legacy.data(), src.data(), src.size());
+			for (uint8_t* pixel = legacy.data(); pixel != legacy.data() + legacy.size(); pixel += 4)
+				std::swap(pixel[0], pixel[2]);
+		});
+		printf("  %-28s %8.3f ms\n", "legacy copy + swap", legacyMs);
+
+		forEachLevel([&](SimdLevel level) {
+			double ms = timeMs([&] { convertBGRXToRGBA(src.data(), dst.data(), numPixels); });
+			printf("  %-28s %8.3f ms  x%.1f\n", (std::string("convertBGRXToRGBA ") + getSimdLevelName(level)).c_str(),
+				ms, legacyMs / ms);
+			check(getSimdLevelName(level), memcmp(dst.data(), legacy.data(), dst.size()) == 0);
+		});
+	}
+
+	//--------------------------------------------------------------
+	// user-018: colorReduction box filters the decoded 1920x1080 frame, then the smaller frame is converted to RGBA.
+	// the jpeg decode in front of it is not part of the addon and doesn't change with the reduction
+	void benchDownscale()
+	{
+		const size_t width = 1920;
+		const size_t height = 1080;
+		std::vector<uint8_t> src(width * height * 4), reference(width * height * 4), dst(width * height * 4);
+		std::vector<uint8_t> rgba(width * height * 4);
+		fillNoise(src.data(), src.size(), 2);
+
+		double fullMs = timeMs([&] { convertBGRXToRGBA(src.data(), rgba.data(), width * height); });
+		printf("  %-28s %8.3f ms  %5.1f MB upload\n", "1/1 convert", fullMs, width * height * 4 / 1e6);
+
+		for (size_t factor = 2; factor <= 8; factor *= 2)
+		{
+			const size_t smallWidth = width / factor;
+			const size_t smallHeight = height / factor;
+			const size_t smallBytes = smallWidth * smallHeight * 4;
+
+			SimdLevel best = getSimdLevel();
+			setSimdLevel(SIMD_SCALAR);
+			downscaleBGRX(src.data(), width, factor, 0, smallHeight, reference.data());
+			setSimdLevel(best);
+
+			forEachLevel([&](SimdLevel level) {
+				double downscaleMs = timeMs([&] { downscaleBGRX(src.data(), width, factor, 0, smallHeight, dst.data()); });
+				double convertMs = timeMs([&] { convertBGRXToRGBA(dst.data(), rgba.data(), smallWidth * smallHeight); });
+				printf("  1/%-2d downscale %-14s %8.3f ms  + convert %.3f ms  %5.1f MB upload\n", (int)factor,
+					getSimdLevelName(level), downscaleMs, convertMs, smallBytes / 1e6);
+				check(getSimdLevelName(level), memcmp(dst.data(), reference.data(), smallBytes) == 0);
+			});
+		}
+	}
+
+	//--------------------------------------------------------------
+	// user-019: the cpu depth decoder, the simd path against the scalar reference. the avx2 atan2, log and exp round
+	// differently, which can move the odd pixel across one of the unwrapping or filter thresholds
+	void benchDepth()
+	{
+		const size_t numPixels = ofxKinectV2DepthDecoder::WIDTH * ofxKinectV2DepthDecoder::HEIGHT;
+		ofxKinectV2DepthDecoder::Scene scene;
+		ofxKinectV2DepthDecoder::makeScene(scene);
+		ofxKinectV2DepthDecoder decoder(1);
+		decoder.loadScene(scene);
+
+		struct Config {
+			const char* name;
+			bool bFilters;
+		};
+		const Config configs[] = { { "filters", true }, { "no filters", false } };
+		for (const Config& config : configs)
+		{
+			decoder.setConfiguration(0.5f, 4.5f, config.bFilters, config.bFilters);
+			std::vector<float> irReference(numPixels), depthReference(numPixels), ir(numPixels), depth(numPixels);
+			SimdLevel best = getSimdLevel();
+			setSimdLevel(SIMD_SCALAR);
+			decoder.decode(scene.packet.data(), irReference.data(), depthReference.data());
+			setSimdLevel(best);
+
+			size_t validPixels = 0;
+			for (float value : depthReference) validPixels += value > 0;
+			printf("  %s, %.1f%% valid depth, center %.1f mm\n", config.name, validPixels * 100.0 / numPixels,
+				depthReference[numPixels / 2 + ofxKinectV2DepthDecoder::WIDTH / 2]);
+
+			double scalarMs = 0;
+			forEachLevel([&](SimdLevel level) {
+				double ms = timeMs([&] { decoder.decode(scene.packet.data(), ir.data(), depth.data()); });
+				if (level == SIMD_SCALAR) scalarMs = ms;
+
+				float maxDepthError = 0;
+				float maxIrError = 0;
+				size_t depthMismatches = 0;
+				for (size_t i = 0; i < numPixels; i++)
+				{
+					const float depthError = std::abs(depth[i] - depthReference[i]);
+					maxDepthError = std::max(maxDepthError, depthError);
+					depthMismatches += !(depthError <= 1.0f);
+					maxIrError = std::max(maxIrError, std::abs(ir[i] - irReference[i]));
+				}
+				printf("  %-28s %8.3f ms  x%.1f  max error %.3g mm, %.3f%% over 1 mm, ir %.3g\n",
+					(std::string("decode ") + getSimdLevelName(level)).c_str(), ms, scalarMs / ms, maxDepthError,
+					depthMismatches * 100.0 / numPixels, maxIrError);
+				check(getSimdLevelName(level), depthMismatches <= numPixels / 1000 && maxIrError == 0);
+			});
+		}
+	}
+
+	//--------------------------------------------------------------
+	// user-020: the depth decoder in row bands on 1 up to all hardware threads, every thread count has to give the
+	// single thread result
+	void benchThreads()
+	{
+		const size_t numPixels = ofxKinectV2DepthDecoder::WIDTH * ofxKinectV2DepthDecoder::HEIGHT;
+		ofxKinectV2DepthDecoder decoder(1);
+		std::vector<std::vector<unsigned char> > packets;
+		if (packetPath)
+		{
+			if (!decoder.loadRecording(packetPath, packets) || packets.empty())
+			{
+				printf("  can't read a recording from %s\n", packetPath);
+				bFailed = true;
+				return;
+			}
+			printf("  %d packets from %s\n", (int)packets.size(), packetPath);
+		}
+		else
+		{
+			ofxKinectV2DepthDecoder::Scene scene;
+			ofxKinectV2DepthDecoder::makeScene(scene);
+			decoder.loadScene(scene);
+			packets.push_back(scene.packet);
+			printf("  synthetic packet\n");
+		}
+		decoder.setConfiguration(0.5f, 4.5f, true, true);
+
+		std::vector<std::vector<float> > irReference(packets.size()), depthReference(packets.size());
+		for (size_t i = 0; i < packets.size(); i++)
+		{
+			irReference[i].resize(numPixels);
+			depthReference[i].resize(numPixels);
+			decoder.decode(packets[i].data(), irReference[i].data(), depthReference[i].data());
+		}
+
+		std::vector<int> threadCounts;
+		const int maxThreads = std::max((int)std::thread::hardware_concurrency(), 1);
+		for (int n = 1; n < maxThreads; n *= 2) threadCounts.push_back(n);
+		threadCounts.push_back(maxThreads);
+
+		std::vector<float> ir(numPixels), depth(numPixels);
+		double singleMs = 0;
+		for (int numThreads : threadCounts)
+		{
+			decoder.setNumThreads(numThreads);
+			size_t next = 0;
+			double ms = timeMs([&] {
+				decoder.decode(packets[next % packets.size()].data(), ir.data(), depth.data());
+				next++;
+			});
+			if (numThreads == 1) singleMs = ms;
+
+			bool bSame = true;
+			for (size_t i = 0; i < packets.size(); i++)
+			{
+				decoder.decode(packets[i].data(), ir.data(), depth.data());
+				bSame &= memcmp(ir.data(), irReference[i].data(), numPixels * sizeof(float)) == 0;
+				bSame &= memcmp(depth.data(), depthReference[i].data(), numPixels * sizeof(float)) == 0;
+			}
+			printf("  %2d threads %8.3f ms  x%.2f  %6.0f packets/s\n", numThreads, ms, singleMs / ms, 1000 / ms);
+			check("banded decode", bSame);
+		}
+	}
+
+	//--------------------------------------------------------------
+	// user-023: registration setup without a cache, building and writing the cache file, and reading it back. a file
+	// with a distortIndex out of range has to be rejected and rebuilt
+	void benchTables()
+	{
+		libfreenect2::Freenect2Device::IrCameraParams depthParams = { 365.4f, 365.4f, 257.4f, 205.3f,
+			0.0905f, -0.2681f, 0.0950f, 0.0f, 0.0f };
+		libfreenect2::Freenect2Device::ColorCameraParams colorParams = { 1081.37f, 1081.37f, 959.5f, 539.5f, 863.0f, 52.0f,
+			0.000449f, 0.000005f, 0.0000713f, 0.0003897f, 0.0000347f, -0.0000212f, 0.0000143f, 0.6395f, 0.0017f, 0.1435f,
+			0.0000055f, 0.000436f, 0.000390f, 0.000077f, -0.0000141f, 0.0000267f, 0.0000267f, -0.0018f, 0.6394f, 0.0052f };
+		const std::string path = "ofxKinectV2Bench.tables";
+		const std::string key = "bench 1.0";
+
+		double noCacheMs = timeMs([&] { ofxKinectV2Registration registration(depthParams, colorParams); });
+		double coldMs = timeMs([&] {
+			std::remove(path.c_str());
+			ofxKinectV2Registration registration(depthParams, colorParams, path, key);
+		});
+		bool bWarm = true;
+		double warmMs = timeMs([&] {
+			ofxKinectV2Registration registration(depthParams, colorParams, path, key);
+			bWarm &= registration.isFromCache();
+		});
+		printf("  %-28s %8.3f ms\n", "no cache", noCacheMs);
+		printf("  %-28s %8.3f ms\n", "cold, build and write", coldMs);
+		printf("  %-28s %8.3f ms  x%.1f\n", "warm, read", warmMs, noCacheMs / warmMs);
+		check("warm start reads the cache", bWarm);
+
+		// first distortIndex entry, after the magic, version, key length, key and both parameter blocks
+		{
+			std::fstream file(path.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+			file.seekp(8 + 4 + 4 + key.size() + sizeof(depthParams) + sizeof(colorParams));
+			const int bad = ofxKinectV2Registration::DEPTH_WIDTH * ofxKinectV2Registration::DEPTH_HEIGHT;
+			file.write((const char*)&bad, sizeof(bad));
+		}
+		ofxKinectV2Registration damaged(depthParams, colorParams, path, key);
+		ofxKinectV2Registration rebuilt(depthParams, colorParams, path, key);
+		check("damaged cache rejected", !damaged.isFromCache() && rebuilt.isFromCache());
+		std::remove(path.c_str());
+	}
+
+	struct Section {
+		const char* name;
+		const char* description;
+		void (*run)();
+	};
+
+	const Section sections[] = {
+		{ "swizzle", "1920x1080 BGRX to RGBA", benchSwizzle },
+		{ "downscale", "colorReduction box filter and RGBA conversion", benchDownscale },
+		{ "depth", "cpu depth decoder, 11 bit unpack to filtered depth", benchDepth },
+		{ "threads", "cpu depth decoder thread scaling", benchThreads },
+		{ "tables", "registration table cache, cold and warm", benchTables },
+	};
+}
+
+//--------------------------------------------------------------
+int main(int argc, char** argv)
+{
+	std::vector<std::string> names;
+	for (int i = 1; i < argc; i++)
+	{
+		const std::string arg = argv[i];
+		if (arg.compare(0, 10, "--packets=") == 0) packetPath = argv[i] + 10;
+		else names.push_back(arg);
+	}
+
+	printf("simd level: %s\n", getSimdLevelName(getSimdLevel()));
+	for (const Section& section : sections)
+	{
+		bool bRun = names.empty();
+		for (const std::string& name : names)
+			bRun |= section.name == name;
+		if (!bRun)
+			continue;
+		printf("\n%s: %s\n", section.name, section.description);
+		section.run();
+	}
+	return bFailed ? 1 : 0;
+}
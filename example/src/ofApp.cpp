@@ -63,11 +63,14 @@ void ofApp::update() {
 
 	for (auto& b : bundles)
 	{
+		// keep the same frame for textures, vbo and draw
+		b.kinect->acquireFrame();
+
 		if (gShowTextures)
 			b.kinect->updateTexture(&b.color, &b.ir, &b.depth, &b.aligned);
 
-		b.numIndices = b.kinect->getVbo(b.vbo);
-		//printf("vbo vertices: %i, indices: %i\n", b.vbo.getNumVertices(), b.numIndices);
+		// the triangle count stays on the gpu, see drawMesh
+		b.kinect->updateMesh(b.vbo);
 	}
 
 }
@@ -113,7 +116,7 @@ void ofApp::draw() {
 		ofRotateX(b.angle.get().x);
 		ofRotateY(b.angle.get().y);
 		ofRotateZ(b.angle.get().z);
-		b.vbo.drawElements(GL_TRIANGLES, b.numIndices);
+		b.kinect->drawMesh(b.vbo);
 		//b.vbo.draw(GL_POINTS, 0, b.vbo.getNumVertices());
 		ofPopMatrix();
 	}
@@ -124,6 +127,9 @@ void ofApp::draw() {
 	if (bDebugVisible)
 		mGui->draw();
 
+	for (auto& b : bundles)
+		b.kinect->releaseFrame();
+
 }
 
 //--------------------------------------------------------------
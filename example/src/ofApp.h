@@ -45,7 +45,6 @@ public:
 		ofTexture depth;
 		ofTexture aligned;
 		ofVbo vbo;
-		int numIndices = 0;
 
 		ofParameterGroup paramGroup;
 		ofParameter<ofVec3f> position;
@@ -7,8 +7,19 @@
 //
 
 #include "ofxKinectV2.h"
+#include "ofxKinectV2DepthProcessor.h"
 #include <GLFW/glfw3.h>
+#include <libfreenect2/depth_packet_processor.h>
 #include <libfreenect2/logger.h>
+#include <libfreenect2/protocol/response.h>
+#include <cstddef>
+#ifndef TARGET_WIN32
+#include <unistd.h>
+#endif
+
+// the point cloud kernel writes straight into these
+static_assert(sizeof(ofVec4f) == 4 * sizeof(float), "ofVec4f must be 4 packed floats");
+static_assert(sizeof(ofFloatColor) == 4 * sizeof(float), "ofFloatColor must be 4 packed floats");
 
 //--------------------------------------------------------------------------------
 ofxKinectV2::ofxKinectV2() {
@@ -20,37 +31,131 @@ ofxKinectV2::ofxKinectV2() {
 		libfreenect2::setGlobalLogger(libfreenect2::createConsoleLogger(libfreenect2::Logger::Warning));
 	}
 
-	frameColor.resize(2);
-	frameDepth.resize(2);
-	frameIr.resize(2);
-	frameRawDepth.resize(2);
-	frameAligned.resize(2);
-	pcVertices.resize(2, vector<ofVec4f>(DEPTH_WIDTH * DEPTH_HEIGHT));
-	pcColors.resize(2, vector<ofFloatColor>(DEPTH_WIDTH * DEPTH_HEIGHT));
+	frameColor.resize(NUM_BUFFERS);
+	frameDepth.resize(NUM_BUFFERS);
+	frameIr.resize(NUM_BUFFERS);
+	frameIrShort.resize(NUM_BUFFERS);
+	frameRawDepth.resize(NUM_BUFFERS);
+	frameAligned.resize(NUM_BUFFERS);
+	frameUserMask.resize(NUM_BUFFERS);
+	frameUserRows.assign(NUM_BUFFERS, std::make_pair(0, DEPTH_HEIGHT));
+	frameBigDepth.resize(NUM_BUFFERS);
+	frameLeases.resize(NUM_BUFFERS);
+	frameInfos.resize(NUM_BUFFERS);
+	uploadColor.resize(NUM_BUFFERS);
+	uploadIr.resize(NUM_BUFFERS);
+	uploadDepth.resize(NUM_BUFFERS);
+	uploadAligned.resize(NUM_BUFFERS);
+	uploadFences.resize(NUM_BUFFERS, 0);
+	framePool = std::make_shared<FramePool>(DEPTH_WIDTH, DEPTH_HEIGHT);
+	bigDepthPool = std::make_shared<FramePool>(COLOR_WIDTH, COLOR_HEIGHT + 2);
+	// point cloud buffers are only sized once the outputs ask for them
+	pcVertices.resize(NUM_BUFFERS);
+	pcColors.resize(NUM_BUFFERS);
+	pcPackedVertices.resize(NUM_BUFFERS);
+	pcPackedColors.resize(NUM_BUFFERS);
+	pcIndices.resize(NUM_BUFFERS);
+	frameUndistorted.resize(NUM_BUFFERS);
+	lodMeshes.resize(NUM_BUFFERS * NUM_LODS);
+	for (auto& time : lodRequestTime) time = 0;
 
 	//set default distance range to 50cm - 600cm
 
 	params.add(minDistance.set("minDistance", 500, 0, 12000));
 	params.add(maxDistance.set("maxDistance", 6000, 0, 12000));
 	params.add(bUseRawDepth.set("rawDepth", false));
+	params.add(bUseShortIr.set("shortIr", false));
+	params.add(queueDepth.set("queueDepth", 1, 1, 8));
+	params.add(bStats.set("stats", false));
+	params.add(bPackedPointCloud.set("packedPointCloud", false));
+	params.add(bCpuTriangulation.set("cpuTriangulation", false));
+	params.add(lodTolerance.set("lodTolerance", 4.0f, 0.5f, 50.0f));
+	params.add(colorReduction.set("colorReduction", 0, 0, 3));
+	params.add(bFastDepth.set("fastDepth", false));
+	params.add(bBilateralFilter.set("bilateralFilter", true));
+	params.add(bEdgeAwareFilter.set("edgeAwareFilter", true));
+	params.add(bClipDepth.set("clipDepth", false));
+	params.add(temporalMedian.set("temporalMedian", 1, 1, MAX_MEDIAN_FRAMES));
+	params.add(temporalSmoothing.set("temporalSmoothing", 0.0f, 0.0f, 0.95f));
+	params.add(temporalThreshold.set("temporalThreshold", 30.0f, 1.0f, 500.0f));
+	params.add(bSubtractBackground.set("subtractBackground", false));
+	params.add(backgroundFrames.set("backgroundFrames", 30, 1, 300));
+	params.add(backgroundTolerance.set("backgroundTolerance", 80.0f, 5.0f, 1000.0f));
+	minDistance.addListener(this, &ofxKinectV2::onDistanceChanged);
+	maxDistance.addListener(this, &ofxKinectV2::onDistanceChanged);
+	queueDepth.addListener(this, &ofxKinectV2::onQueueDepthChanged);
+	bStats.addListener(this, &ofxKinectV2::onStatsChanged);
+	bFastDepth.addListener(this, &ofxKinectV2::onDepthConfigChanged);
+	bBilateralFilter.addListener(this, &ofxKinectV2::onDepthConfigChanged);
+	bEdgeAwareFilter.addListener(this, &ofxKinectV2::onDepthConfigChanged);
+	bClipDepth.addListener(this, &ofxKinectV2::onDepthConfigChanged);
+	bSubtractBackground.addListener(this, &ofxKinectV2::onSubtractBackgroundChanged);
+
+	statsParams.setName("stats");
+	for (int i = 0; i < NUM_STAGES; i++)
+	{
+		statsParams.add(statsLabels[i].set(getStageName((Stage)i), ""));
+		statsLabels[i].setSerializable(false);
+	}
+	statsParams.add(statsCounters.set("frames", ""));
+	statsCounters.setSerializable(false);
+	ofAddListener(ofEvents().update, this, &ofxKinectV2::onUpdate);
+
+	const char* outputNames[NUM_OUTPUTS] = { "color", "ir", "rawDepthPixels", "depth", "aligned", "pointCloud", "pointCloudColors", "bigDepth" };
+	outputParams.setName("outputs");
+	for (int i = 0; i < NUM_OUTPUTS; i++)
+	{
+		outputParams.add(bOutputs[i].set(outputNames[i], (OUTPUT_ALL & (1 << i)) != 0));
+		bOutputs[i].addListener(this, &ofxKinectV2::onOutputChanged);
+	}
+	params.add(outputParams);
+
+	pool.reset(new ofxKinectV2Kernels::ThreadPool());
+}
 
-	computeIndices.unload();
-	computeIndices.setupShaderFromSource(GL_COMPUTE_SHADER, comp_glsl);
-	computeIndices.linkProgram();
+//--------------------------------------------------------------------------------
+void ofxKinectV2::setupMesh()
+{
+	// on first getVbo so the rest of the addon runs without a GL context
+	if (bMeshSetup)
+		return;
+	bMeshSetup = true;
 
 	depthTexture.allocate(DEPTH_WIDTH, DEPTH_HEIGHT, GL_R32F);
+	userTexture.allocate(DEPTH_WIDTH, DEPTH_HEIGHT, GL_R8);
 
+	// the full level is sized for the compute shader, the others grow to what their meshes need
 	vector<int> indices((DEPTH_WIDTH - 1) * (DEPTH_HEIGHT - 1) * 6, 0);
-	indicesBuffer.allocate(indices, GL_DYNAMIC_DRAW);
+	meshBuffers[LOD_FULL].indices.allocate(indices, GL_DYNAMIC_DRAW);
 
-	atomicCounter.allocate();
-	int data = 0;
-	atomicCounter.setData(sizeof(int), &data, GL_DYNAMIC_COPY);
+	// DrawElementsIndirectCommand { count, instanceCount, firstIndex, baseVertex, baseInstance }
+	uint32_t command[5] = { 0, 1, 0, 0, 0 };
+	for (auto& buffers : meshBuffers)
+	{
+		if (!buffers.indices.isAllocated()) buffers.indices.allocate();
+		buffers.drawCommand.allocate();
+		buffers.drawCommand.setData(sizeof(command), command, GL_DYNAMIC_COPY);
+	}
 }
 
 //--------------------------------------------------------------------------------
 ofxKinectV2::~ofxKinectV2() {
 	close();
+	if (packedVao) glDeleteVertexArrays(1, &packedVao);
+	minDistance.removeListener(this, &ofxKinectV2::onDistanceChanged);
+	maxDistance.removeListener(this, &ofxKinectV2::onDistanceChanged);
+	queueDepth.removeListener(this, &ofxKinectV2::onQueueDepthChanged);
+	bStats.removeListener(this, &ofxKinectV2::onStatsChanged);
+	bFastDepth.removeListener(this, &ofxKinectV2::onDepthConfigChanged);
+	bBilateralFilter.removeListener(this, &ofxKinectV2::onDepthConfigChanged);
+	bEdgeAwareFilter.removeListener(this, &ofxKinectV2::onDepthConfigChanged);
+	bClipDepth.removeListener(this, &ofxKinectV2::onDepthConfigChanged);
+	bSubtractBackground.removeListener(this, &ofxKinectV2::onSubtractBackgroundChanged);
+	ofRemoveListener(ofEvents().update, this, &ofxKinectV2::onUpdate);
+	for (int i = 0; i < NUM_OUTPUTS; i++)
+	{
+		bOutputs[i].removeListener(this, &ofxKinectV2::onOutputChanged);
+	}
 }
 
 //--------------------------------------------------------------------------------
@@ -85,7 +190,7 @@ unsigned int ofxKinectV2::getNumDevices() {
 }
 
 //--------------------------------------------------------------------------------
-bool ofxKinectV2::open(unsigned int deviceId) {
+bool ofxKinectV2::open(unsigned int deviceId, unsigned int outputs, Pipeline pipeline) {
 
 	vector <KinectDeviceInfo> devices = getDeviceList();
 
@@ -100,20 +205,35 @@ bool ofxKinectV2::open(unsigned int deviceId) {
 	}
 
 	string serial = devices[deviceId].serial;
-	return open(serial);
+	return open(serial, outputs, pipeline);
 }
 
 //--------------------------------------------------------------------------------
-bool ofxKinectV2::open(string serial) {
+bool ofxKinectV2::open(string serial, unsigned int outputs, Pipeline pipeline) {
 
 	close();
 
 	params.setName("kinectV2_" + serial);
+	setOutputs(outputs);
 
-	int retVal = openKinect(serial);
+	int retVal = openKinect(serial, pipeline);
 
-	if (retVal == 0) startThread(true);
-	else return false;
+	if (retVal != 0) return false;
+
+	if (bAsyncUpload && !bZeroCopy) allocateUploadBuffers(outputs);
+
+	// the temporal filter starts over with the new device
+	temporalMedianFrames = 0;
+	temporalState.clear();
+	// and so does the background
+	bBackgroundReset = true;
+
+	// acquire runs on the ofThread, register and derive each on their own thread
+	acquiredQueue.reopen();
+	registeredQueue.reopen();
+	registerThread = std::thread(&ofxKinectV2::registerStage, this);
+	deriveThread = std::thread(&ofxKinectV2::deriveStage, this);
+	startThread(true);
 
 	bOpened = true;
 	return true;
@@ -122,225 +242,1872 @@ bool ofxKinectV2::open(string serial) {
 //--------------------------------------------------------------------------------
 void ofxKinectV2::threadedFunction() 
 {
-	libfreenect2::Frame undistorted(DEPTH_WIDTH, DEPTH_HEIGHT, 4), registered(DEPTH_WIDTH, DEPTH_HEIGHT, 4);
-
+	// acquire stage: takes frame sets off the listener and decides what gets made from them
 	while (isThreadRunning()) 
 	{
 		if (!bOpened) continue;
 
-		listener->waitForNewFrame(frames);
-		libfreenect2::Frame *rgb = frames[libfreenect2::Frame::Color];
-		libfreenect2::Frame *ir = frames[libfreenect2::Frame::Ir];
-		libfreenect2::Frame *depth = frames[libfreenect2::Frame::Depth];
-		registration->apply(rgb, depth, &undistorted, &registered);
+		const unsigned int outputs = outputMask;
+		if (bDepthConfigDirty && ofGetElapsedTimeMicros() >= depthConfigDue && bDepthConfigDirty.exchange(false))
+		{
+			// libfreenect2 only takes a new configuration while the device is stopped, the decoders read it on
+			// their own threads without a lock
+			if (runningStreams) dev->stop();
+			runningStreams = 0;
+			dev->setConfiguration(getDepthConfig());
+		}
+		if (getStreams(outputs) != runningStreams)
+		{
+			startStreams(outputs);
+		}
+		if (!runningStreams)
+		{
+			// nothing asked for, wait for setOutputs
+			sleep(10);
+			continue;
+		}
 
-		frameColor[indexBack].setFromPixels(rgb->data, rgb->width, rgb->height, 4);
-		frameIr[indexBack].setFromPixels((float *)ir->data, ir->width, ir->height, 1);
-		frameRawDepth[indexBack].setFromPixels((float *)depth->data, depth->width, depth->height, 1);
-		frameAligned[indexBack].setFromPixels(registered.data, registered.width, registered.height, 4);
-		
-		listener->release(frames);
+		// time out now and then so changed outputs and close() are picked up without frames coming in
+		uint64_t waitBegin = beginStage();
+		if (!listener->waitForNewFrame(frames, 100)) continue;
+		endStage(STAGE_WAIT, waitBegin);
 
-		for (auto pixel : frameColor[indexBack].getPixelsIter()) // swap rgb
-			std::swap(pixel[0], pixel[2]);
-		for (auto pixel : frameIr[indexBack].getPixelsIter()) // downscale to 0-1
-			pixel[0] /= 65535.0f;
-		for (auto pixel : frameAligned[indexBack].getPixelsIter()) // swap rgb
-			std::swap(pixel[0], pixel[2]);
+		std::unique_ptr<FrameJob> job(new FrameJob());
+		job->info.hostTime = ofGetElapsedTimeMicros();
 
-		if(!bUseRawDepth) 
+		// the listener gave us ownership, the frames go away once the last stage or lease is done with them
+		auto takeFrame = [&](libfreenect2::Frame::Type type)
 		{
-			auto& depth = frameDepth[indexBack];
-			auto& raw_depth = frameRawDepth[indexBack];
-			if ((depth.getWidth() != raw_depth.getWidth()) || (depth.getHeight() != raw_depth.getHeight()))
-			{
-				depth.allocate(raw_depth.getWidth(), raw_depth.getHeight(), 3);
-			}
-			std::pair<float, float> minmax(0.0, 0.8);
-			for (int i = 0; i < raw_depth.size(); i++)
-			{
-				float hue = ofMap(raw_depth[i], minDistance, maxDistance, minmax.first, minmax.second, true);
-				if (hue == minmax.first || hue == minmax.second) depth.setColor(i * 3, ofColor(0));
-				else depth.setColor(i * 3, ofFloatColor::fromHsb(hue, 0.9, 0.9));
-			}
-		}
-		
-		// get point cloud
+			auto it = frames.find(type);
+			return std::shared_ptr<libfreenect2::Frame>(it != frames.end() ? it->second : nullptr);
+		};
+		job->color = takeFrame(libfreenect2::Frame::Color);
+		job->ir = takeFrame(libfreenect2::Frame::Ir);
+		job->depth = takeFrame(libfreenect2::Frame::Depth);
+		frames.clear();
+
+		// products we can make from the frames that arrived
+		const bool bRgb = job->color != nullptr;
+		const bool bDepth = job->depth != nullptr;
+		job->bColor = bRgb && (outputs & OUTPUT_COLOR);
+		job->bIr = job->ir && (outputs & OUTPUT_IR);
+		job->bDepth = bDepth && (outputs & OUTPUT_DEPTH) && !bUseRawDepth;
+		job->bPointCloud = bDepth && (outputs & OUTPUT_POINT_CLOUD);
+		job->bRawDepth = bDepth && (outputs & OUTPUT_RAW_DEPTH);
+		job->bAligned = bRgb && bDepth && (outputs & OUTPUT_ALIGNED);
+		job->bPointCloudColors = bRgb && job->bPointCloud && (outputs & OUTPUT_POINT_CLOUD_COLORS);
+		job->bBigDepth = bRgb && bDepth && (outputs & OUTPUT_BIG_DEPTH);
+
+		if (bRgb)
 		{
-			float rgbPix = 0;
-			size_t i = 0;
-			for (int y = 0; y < DEPTH_HEIGHT; y++)
-			{
-				for (int x = 0; x < DEPTH_WIDTH; x++)
-				{
-					auto& pt = pcVertices[indexBack][i];
-					registration->getPointXYZRGB(&undistorted, &registered, y, x, pt.x, pt.y, pt.z, rgbPix);
-					pt.z *= -1.0f;
-					pt.w = 1.0f;
-					const uint8_t *p = reinterpret_cast<uint8_t*>(&rgbPix);
-					pcColors[indexBack][i] = ofColor(p[2], p[1], p[0]);
-					i++;
-				}
-			}
+			job->info.colorSequence = job->color->sequence;
+			job->info.colorTimestamp = job->color->timestamp;
+			countSequence(job->color.get(), lastColorSequence);
 		}
-		
-		//while (bNewFrame)
+		if (bDepth)
 		{
-			// wait for main thread
+			job->info.depthSequence = job->depth->sequence;
+			job->info.depthTimestamp = job->depth->timestamp;
+			countSequence(job->depth.get(), lastDepthSequence);
 		}
 
-		std::lock_guard<std::mutex> guard(mutex);
-		std::swap(indexFront, indexBack);
-		bNewFrame = true;
+		// blocks while the register stage is queueDepth sets behind, the device drops frames meanwhile
+		acquiredQueue.push(std::move(job));
 	}
 }
 
+//--------------------------------------------------------------------------------
+void ofxKinectV2::registerStage()
+{
+	std::unique_ptr<FrameJob> job;
+	while (acquiredQueue.pop(job))
+	{
+		if (job->depth)
+		{
+			uint64_t temporalBegin = beginStage();
+			filterDepthTemporal(job->depth.get());
+			endStage(STAGE_TEMPORAL, temporalBegin);
+		}
+
+		uint64_t stageBegin = beginStage();
 
-void ofxKinectV2::updateTexture(ofTexture* color, ofTexture* ir, ofTexture* depth, ofTexture* aligned)
+		// the registration tables and the pools follow the reduction, only this stage uses them
+		const int scale = 1 << colorReduction;
+		if (registration->getColorScale() != scale) registration->setColorScale(scale);
+		if (bigDepthPool->width != (size_t)(COLOR_WIDTH / scale))
+		{
+			bigDepthPool = std::make_shared<FramePool>(COLOR_WIDTH / scale, COLOR_HEIGHT / scale + 2);
+		}
+		if (job->color && scale > 1) reduceColor(*job, scale);
+
+		// pooled frames so every set in flight has its own, zero copy leases keep them alive
+		const bool bRegister = job->bAligned || job->bPointCloudColors || job->bBigDepth;
+		// the user mask is segmented from the undistorted depth, whatever the outputs
+		const bool bUndistort = job->bPointCloud || (job->depth && bSubtractBackground);
+		if (bRegister || bUndistort)
+		{
+			job->undistorted = acquirePooledFrame(framePool);
+		}
+		if (bRegister)
+		{
+			// bigdepth is the z buffer registration builds anyway, kept only on frames that ask for it
+			job->registered = acquirePooledFrame(framePool);
+			if (job->bBigDepth) job->bigDepth = acquirePooledFrame(bigDepthPool);
+			registration->apply(job->color.get(), job->depth.get(), job->undistorted.get(), job->registered.get(), *pool,
+				true, job->bigDepth.get());
+		}
+		else if (bUndistort)
+		{
+			registration->undistortDepth(job->depth.get(), job->undistorted.get(), *pool);
+		}
+		endStage(STAGE_REGISTER, stageBegin);
+
+		registeredQueue.push(std::move(job));
+	}
+	registeredQueue.close();
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::filterDepthTemporal(libfreenect2::Frame* depth)
 {
-	std::lock_guard<std::mutex> guard(mutex);
-	if (!bNewFrame)
+	const int frames = temporalMedian;
+	const int medianFrames = std::max(1, frames % 2 == 0 ? frames - 1 : frames);
+	const float smoothing = temporalSmoothing;
+	const float threshold = temporalThreshold;
+	if (medianFrames == 1) temporalMedianFrames = 0;
+	if (smoothing <= 0.0f) temporalState.clear();
+	if ((medianFrames == 1 && smoothing <= 0.0f) || (int)depth->width != DEPTH_WIDTH || (int)depth->height != DEPTH_HEIGHT)
 		return;
 
-	if (frameColor[indexFront].isAllocated() && color)
-		color->loadData(frameColor[indexFront]);
-
-	if (frameIr[indexFront].isAllocated() && ir)
-		ir->loadData(frameIr[indexFront]);
+	// filtered in place, so registration, raw depth, colorized depth and the point cloud all get the result
+	const size_t numPixels = DEPTH_WIDTH * DEPTH_HEIGHT;
+	float* data = (float*)depth->data;
+	if (medianFrames > 1 && temporalHistory.empty()) temporalHistory.resize(MAX_MEDIAN_FRAMES * numPixels);
+	if (smoothing > 0.0f && temporalState.empty()) temporalState.resize(numPixels, 0.0f);
 
-	if (frameDepth[indexFront].isAllocated() && depth)
-		depth->loadData(frameDepth[indexFront]);
+	// a new frame count starts the ring over with every plane holding this frame
+	const bool bRestart = medianFrames > 1 && medianFrames != temporalMedianFrames;
+	if (bRestart)
+	{
+		temporalMedianFrames = medianFrames;
+		temporalHead = 0;
+	}
+	const int head = temporalHead;
 
-	if (frameRawDepth[indexFront].isAllocated() && aligned)
-		aligned->loadData(frameAligned[indexFront]);
+	pool->parallelFor(DEPTH_HEIGHT, [&](size_t rowBegin, size_t rowEnd)
+	{
+		const size_t begin = rowBegin * DEPTH_WIDTH;
+		const size_t count = (rowEnd - rowBegin) * DEPTH_WIDTH;
+		if (medianFrames > 1)
+		{
+			const float* frames[MAX_MEDIAN_FRAMES];
+			for (int k = 0; k < medianFrames; k++)
+			{
+				float* plane = &temporalHistory[k * numPixels + begin];
+				if (bRestart || k == head) memcpy(plane, data + begin, count * sizeof(float));
+				frames[k] = plane;
+			}
+			ofxKinectV2Kernels::medianDepth(frames, medianFrames, data + begin, count);
+		}
+		if (smoothing > 0.0f)
+		{
+			ofxKinectV2Kernels::smoothDepth(data + begin, &temporalState[begin], data + begin, count, smoothing, threshold);
+		}
+	});
 
-	bNewFrame = false;
+	if (medianFrames > 1) temporalHead = (head + 1) % medianFrames;
 }
 
-std::vector<ofVec4f>& ofxKinectV2::getPointCloudVertices()
+//--------------------------------------------------------------------------------
+void ofxKinectV2::reduceColor(FrameJob& job, int scale)
 {
-	return pcVertices[indexFront];
+	// libfreenect2 decodes the jpeg at full size, box filtering it here is the first thing that touches the
+	// pixels so every later copy, registration gather and upload moves 1/scale^2 of the bytes
+	const size_t width = COLOR_WIDTH / scale;
+	const size_t height = COLOR_HEIGHT / scale;
+	if (!colorPool || colorPool->width != width)
+	{
+		colorPool = std::make_shared<FramePool>(width, height);
+	}
+
+	const libfreenect2::Frame* src = job.color.get();
+	auto reduced = acquirePooledFrame(colorPool);
+	pool->parallelFor(height, [&](size_t rowBegin, size_t rowEnd)
+	{
+		ofxKinectV2Kernels::downscaleBGRX(src->data, src->width, scale, rowBegin, rowEnd, reduced->data);
+	});
+	reduced->timestamp = src->timestamp;
+	reduced->sequence = src->sequence;
+	reduced->exposure = src->exposure;
+	reduced->gain = src->gain;
+	reduced->gamma = src->gamma;
+	reduced->status = src->status;
+	reduced->format = src->format;
+
+	// the full size frame is freed here instead of with the lease
+	job.color = reduced;
 }
 
-std::vector<ofFloatColor>& ofxKinectV2::getPointCloudColors()
+//--------------------------------------------------------------------------------
+void ofxKinectV2::deriveStage()
 {
-	return pcColors[indexFront];
+	std::unique_ptr<FrameJob> job;
+	while (registeredQueue.pop(job))
+	{
+		deriveOutputs(*job);
+
+		FrameInfo& info = frameInfos[indexBack];
+		info = job->info;
+		info.readyTime = ofGetElapsedTimeMicros();
+		if (bStatsEnabled)
+		{
+			stageHistograms[STAGE_LATENCY].record(info.readyTime - info.hostTime);
+			framesProcessed++;
+		}
+
+		// copy mode frames are deleted here, zero copy ones live on in the lease
+		job.reset();
+
+		const int published = indexBack;
+		publishFrame();
+		notifyFrameReady(published);
+	}
 }
 
-int ofxKinectV2::getVbo(ofVbo& vbo)
+//--------------------------------------------------------------------------------
+void ofxKinectV2::deriveOutputs(FrameJob& job)
 {
-	auto& vertices = pcVertices[indexFront];
-	auto& colors = pcColors[indexFront];
-	if (!vbo.getIsAllocated())
+	// derive stage: everything that writes into the back buffer
+	libfreenect2::Frame *rgb = job.color.get();
+	libfreenect2::Frame *ir = job.ir.get();
+	libfreenect2::Frame *depth = job.depth.get();
+	libfreenect2::Frame *undistorted = job.undistorted.get();
+	libfreenect2::Frame *registered = job.registered.get();
+	libfreenect2::Frame *bigDepth = job.bigDepth.get();
+
+	uint64_t stageBegin = beginStage();
+	if (bZeroCopy)
 	{
-		vector<ofVec2f> texCoords;
-		for (int y = 0; y < DEPTH_HEIGHT; y++)
+		// keep the frames alive in a lease instead of copying them out
+		auto lease = std::make_shared<FrameLease>();
+		lease->colorFrame = job.color;
+		lease->irFrame = job.ir;
+		lease->depthFrame = job.depth;
+		lease->undistortedFrame = job.undistorted;
+		lease->registeredFrame = job.registered;
+		lease->bigDepthFrame = job.bigDepth;
+
+		// the slot gets views too so updateTexture and getVbo work unchanged, disabled products are left empty
+		if (job.bColor)
 		{
-			float coord_y = (float)y / DEPTH_HEIGHT;
-			for (int x = 0; x < DEPTH_WIDTH; x++)
-			{
-				float coord_x = (float)x / DEPTH_HEIGHT;
-				texCoords.emplace_back(coord_x, coord_y);
-			}
+			lease->color.setFromExternalPixels(rgb->data, rgb->width, rgb->height, OF_PIXELS_BGRA);
+			frameColor[indexBack].setFromExternalPixels(rgb->data, rgb->width, rgb->height, OF_PIXELS_BGRA);
 		}
-		vbo.setTexCoordData(&texCoords[0], texCoords.size(), GL_STATIC_DRAW);
-		vbo.setVertexData(&vertices[0].x, 4, vertices.size(), GL_DYNAMIC_DRAW);
-		vbo.setColorData(&colors[0], colors.size(), GL_DYNAMIC_DRAW);
-		vbo.setIndexBuffer(indicesBuffer);
+		else frameColor[indexBack].clear();
+
+		if (job.bIr)
+		{
+			lease->ir.setFromExternalPixels((float *)ir->data, ir->width, ir->height, 1);
+			if (bUseShortIr) copyIr(ir, indexBack);
+			else frameIr[indexBack].setFromExternalPixels((float *)ir->data, ir->width, ir->height, 1);
+		}
+		else
+		{
+			frameIr[indexBack].clear();
+			frameIrShort[indexBack].clear();
+		}
+
+		if (job.bRawDepth || job.bDepth)
+		{
+			lease->rawDepth.setFromExternalPixels((float *)depth->data, depth->width, depth->height, 1);
+			frameRawDepth[indexBack].setFromExternalPixels((float *)depth->data, depth->width, depth->height, 1);
+		}
+		else frameRawDepth[indexBack].clear();
+
+		if (job.bAligned)
+		{
+			lease->aligned.setFromExternalPixels(registered->data, registered->width, registered->height, OF_PIXELS_BGRA);
+			frameAligned[indexBack].setFromExternalPixels(registered->data, registered->width, registered->height, OF_PIXELS_BGRA);
+		}
+		else frameAligned[indexBack].clear();
+
+		if (job.bBigDepth)
+		{
+			lease->bigDepth.setFromExternalPixels((float *)bigDepth->data, bigDepth->width, bigDepth->height, 1);
+			frameBigDepth[indexBack].setFromExternalPixels((float *)bigDepth->data, bigDepth->width, bigDepth->height, 1);
+		}
+		else frameBigDepth[indexBack].clear();
+
+		// replacing the old lease hands its frames back unless a consumer still holds it
+		frameLeases[indexBack] = lease;
 	}
 	else
 	{
-		vbo.updateVertexData(&vertices[0].x, vertices.size());
-		vbo.updateColorData(&colors[0].r, colors.size());
+		// with async uploads the copies below land in the mapped upload buffers
+		if (job.bColor) bindUploadView(frameColor[indexBack], uploadColor[indexBack], rgb->width, rgb->height, 4);
+		if (job.bIr && bUseShortIr) bindUploadView(frameIrShort[indexBack], uploadIr[indexBack], ir->width, ir->height, 1);
+		if (job.bIr && !bUseShortIr) bindUploadView(frameIr[indexBack], uploadIr[indexBack], ir->width, ir->height, 1);
+		if (job.bDepth) bindUploadView(frameDepth[indexBack], uploadDepth[indexBack], depth->width, depth->height, 3);
+		if (job.bAligned) bindUploadView(frameAligned[indexBack], uploadAligned[indexBack], registered->width, registered->height, 4);
+
+		if (job.bColor) copyBGRX(rgb, frameColor[indexBack]);
+		else frameColor[indexBack].clear();
+
+		if (job.bIr) copyIr(ir, indexBack);
+		else
+		{
+			frameIr[indexBack].clear();
+			frameIrShort[indexBack].clear();
+		}
+
+		if (job.bRawDepth) frameRawDepth[indexBack].setFromPixels((float *)depth->data, depth->width, depth->height, 1);
+		else frameRawDepth[indexBack].clear();
+
+		if (job.bAligned) copyBGRX(registered, frameAligned[indexBack]);
+		else frameAligned[indexBack].clear();
+
+		if (job.bBigDepth) frameBigDepth[indexBack].setFromPixels((float *)bigDepth->data, bigDepth->width, bigDepth->height, 1);
+		else frameBigDepth[indexBack].clear();
 	}
+	endStage(STAGE_COPY, stageBegin);
+
+	if (job.bDepth) 
+	{
+		stageBegin = beginStage();
+		auto& dst_depth = frameDepth[indexBack];
+		if ((dst_depth.getWidth() != depth->width) || (dst_depth.getHeight() != depth->height))
+		{
+			dst_depth.allocate(depth->width, depth->height, 3);
+		}
+		if (bDepthLutDirty.exchange(false)) updateDepthLut();
 
-	auto& depth = frameRawDepth[indexFront];
-	if (depth.getWidth() && depth.getHeight())
+		// one lut lookup per pixel straight from the device frame, rows split across the pool
+		const size_t width = depth->width;
+		const float* src = reinterpret_cast<const float*>(depth->data);
+		unsigned char* dst = dst_depth.getData();
+		pool->parallelFor(depth->height, [&](size_t begin, size_t end)
+		{
+			ofxKinectV2Kernels::colorizeDepth(src + begin * width, dst + begin * width * 3, (end - begin) * width, depthLut.data(), depthLut.size());
+		});
+		endStage(STAGE_COLORIZE, stageBegin);
+	}
+	else frameDepth[indexBack].clear();
+
+	// user mask against the learned background, the point cloud and the meshes leave the rest out
+	auto& userMask = frameUserMask[indexBack];
+	auto& userRows = frameUserRows[indexBack];
+	const uint8_t* user = nullptr;
+	userRows = std::make_pair(0, DEPTH_HEIGHT);
+	if (undistorted && bSubtractBackground)
+	{
+		stageBegin = beginStage();
+		if (updateUserMask(reinterpret_cast<const float*>(undistorted->data), userMask, userRows)) user = userMask.getData();
+		endStage(STAGE_BACKGROUND, stageBegin);
+	}
+	else userMask.clear();
+	
+	// get point cloud, in one of the two layouts
+	auto& pcv = pcVertices[indexBack];
+	auto& pcc = pcColors[indexBack];
+	auto& packedVertices = pcPackedVertices[indexBack];
+	auto& packedColors = pcPackedColors[indexBack];
+	const bool bPacked = job.bPointCloud && bPackedPointCloud;
+	if (job.bPointCloud)
 	{
+		stageBegin = beginStage();
+		const size_t numPoints = DEPTH_WIDTH * DEPTH_HEIGHT;
+		const float* depthData = reinterpret_cast<const float*>(undistorted->data);
+		const uint32_t* colorData = job.bPointCloudColors ? reinterpret_cast<const uint32_t*>(registered->data) : nullptr;
+
+		if (bPacked)
 		{
-			std::lock_guard<std::mutex> guard(mutex);
-			depthTexture.loadData(&depth[0], DEPTH_WIDTH, DEPTH_HEIGHT, GL_RED);
+			if (packedVertices.size() != numPoints * 4) packedVertices.resize(numPoints * 4);
+			if (job.bPointCloudColors && packedColors.size() != numPoints) packedColors.resize(numPoints);
+			else if (!job.bPointCloudColors) vector<uint32_t>().swap(packedColors);
 
-			//vector<float> dd(512 * 424);
-			//memcpy(&dd[0], depth.getData(), sizeof(float) * dd.size());
+			uint16_t* vertices = packedVertices.data();
+			uint32_t* colors = job.bPointCloudColors ? packedColors.data() : nullptr;
+			pool->parallelFor(DEPTH_HEIGHT, [&](size_t begin, size_t end)
+			{
+				ofxKinectV2Kernels::computePointCloudPacked(depthData, colorData, rayX.data(), rayY.data(), DEPTH_WIDTH, begin, end, vertices, colors, user);
+			});
 		}
-		
-		depthTexture.bindAsImage(0, GL_READ_ONLY);
-		indicesBuffer.bindBase(GL_SHADER_STORAGE_BUFFER, 0);
-		atomicCounter.bindBase(GL_ATOMIC_COUNTER_BUFFER, 0);
+		else
+		{
+			if (pcv.size() != numPoints) pcv.resize(numPoints);
+			if (job.bPointCloudColors && pcc.size() != numPoints) pcc.resize(numPoints);
+			else if (!job.bPointCloudColors) vector<ofFloatColor>().swap(pcc);
+
+			// whole organized cloud in one go from the ray tables, written straight into the vectors
+			float* vertices = &pcv[0].x;
+			float* colors = job.bPointCloudColors ? &pcc[0].r : nullptr;
+			pool->parallelFor(DEPTH_HEIGHT, [&](size_t begin, size_t end)
+			{
+				ofxKinectV2Kernels::computePointCloud(depthData, colorData, rayX.data(), rayY.data(), DEPTH_WIDTH, begin, end, vertices, colors, user);
+			});
+		}
+		endStage(STAGE_POINT_CLOUD, stageBegin);
+	}
+	if (!job.bPointCloud || bPacked)
+	{
+		vector<ofVec4f>().swap(pcv);
+		vector<ofFloatColor>().swap(pcc);
+	}
+	if (!bPacked)
+	{
+		vector<uint16_t>().swap(packedVertices);
+		vector<uint32_t>().swap(packedColors);
+	}
 
-		computeIndices.begin();
-		computeIndices.setUniform1i("bUseUserMap", 0);
-		computeIndices.dispatchCompute(DEPTH_WIDTH / 32, DEPTH_HEIGHT / 8, 1);
-		computeIndices.end();
+	// mesh indices from the same undistorted depth the vertices come from, on the cpu or later in getVbo
+	auto& indices = pcIndices[indexBack];
+	auto& undistortedDepth = frameUndistorted[indexBack];
+	const bool bCpuMesh = job.bPointCloud && bCpuTriangulation;
+	if (bCpuMesh)
+	{
+		stageBegin = beginStage();
+		triangulate(reinterpret_cast<const float*>(undistorted->data), user, indices);
+		endStage(STAGE_TRIANGULATE, stageBegin);
+	}
+	else vector<uint32_t>().swap(indices);
 
-		indicesBuffer.unbindBase(GL_SHADER_STORAGE_BUFFER, 0);
-		atomicCounter.unbindBase(GL_ATOMIC_COUNTER_BUFFER, 0);
+	if (job.bPointCloud && !bCpuMesh)
+	{
+		if (bZeroCopy) undistortedDepth.setFromExternalPixels((float *)undistorted->data, undistorted->width, undistorted->height, 1);
+		else undistortedDepth.setFromPixels((float *)undistorted->data, undistorted->width, undistorted->height, 1);
+	}
+	else undistortedDepth.clear();
 
-#if 0
-		auto atomic = atomicCounter.map<int>(GL_READ_ONLY);
-		int num = atomic[0];
-		atomicCounter.unmap();
-		cout << "atomic: " << num << endl;
-#endif
-		int data = 0;
-		atomicCounter.updateData(0, sizeof(int), &data);
+	buildLods(job.bPointCloud);
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::triangulate(const float* depth, const uint8_t* user, std::vector<uint32_t>& indices)
+{
+	triangulateRows(DEPTH_HEIGHT - 1, (DEPTH_WIDTH - 1) * 6, [&](size_t rowBegin, size_t rowEnd, uint32_t* out)
+	{
+		return ofxKinectV2Kernels::triangulateDepth(depth, user, DEPTH_WIDTH, 1 + rowBegin, 1 + rowEnd, MESH_MAX_NEAR, out);
+	}, triangulateScratch, indices);
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::triangulateRows(size_t numRows, size_t maxRowIndices, const std::function<size_t(size_t, size_t, uint32_t*)>& rows,
+	TriangulateScratch& scratch, std::vector<uint32_t>& indices)
+{
+	// fixed bands keep the row order, each fills its own scratch and they are packed back to back after
+	const size_t numBands = pool->getNumThreads() * 4;
+	const size_t maxBandIndices = ((numRows + numBands - 1) / numBands) * maxRowIndices;
+	scratch.bands.resize(numBands);
+	scratch.counts.resize(numBands + 1);
+	pool->parallelFor(numBands, [&](size_t begin, size_t end)
+	{
+		for (size_t band = begin; band < end; band++)
+		{
+			auto& bandIndices = scratch.bands[band];
+			if (bandIndices.size() < maxBandIndices) bandIndices.resize(maxBandIndices);
+			size_t rowBegin = numRows * band / numBands;
+			size_t rowEnd = numRows * (band + 1) / numBands;
+			scratch.counts[band + 1] = rowBegin < rowEnd ? rows(rowBegin, rowEnd, bandIndices.data()) : 0;
+		}
+	});
+
+	auto& counts = scratch.counts;
+	counts[0] = 0;
+	for (size_t band = 0; band < numBands; band++) counts[band + 1] += counts[band];
+	indices.resize(counts[numBands]);
+	if (indices.empty())
+		return;
+
+	uint32_t* dst = indices.data();
+	pool->parallelFor(numBands, [&](size_t begin, size_t end)
+	{
+		for (size_t band = begin; band < end; band++)
+		{
+			size_t offset = counts[band];
+			memcpy(dst + offset, scratch.bands[band].data(), (counts[band + 1] - offset) * sizeof(uint32_t));
+		}
+	});
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::onQueueDepthChanged(int& depth)
+{
+	acquiredQueue.setCapacity(depth);
+	registeredQueue.setCapacity(depth);
+}
+
+//--------------------------------------------------------------------------------
+uint64_t ofxKinectV2::beginStage() const
+{
+	return bStatsEnabled.load(std::memory_order_relaxed) ? ofGetElapsedTimeMicros() : 0;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::endStage(Stage stage, uint64_t begin)
+{
+	if (begin) stageHistograms[stage].record(ofGetElapsedTimeMicros() - begin);
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::countSequence(const libfreenect2::Frame* frame, int64_t& last)
+{
+	// anything skipped in the device sequence was dropped before it reached us
+	if (bStatsEnabled && last >= 0 && frame->sequence > last + 1)
+	{
+		framesDropped += frame->sequence - last - 1;
 	}
+	last = frame->sequence;
+}
 
-	return indicesBuffer.size() / sizeof(int);
+//--------------------------------------------------------------------------------
+void ofxKinectV2::onStatsChanged(bool& enabled)
+{
+	if (enabled && !bStatsEnabled) resetStats();
+	bStatsEnabled = enabled;
 }
 
 //--------------------------------------------------------------------------------
-void ofxKinectV2::close() {
-	if (!bOpened)
+const char* ofxKinectV2::getStageName(Stage stage)
+{
+	switch (stage)
+	{
+	case STAGE_WAIT: return "wait";
+	case STAGE_REGISTER: return "register";
+	case STAGE_COPY: return "copy";
+	case STAGE_COLORIZE: return "colorize";
+	case STAGE_POINT_CLOUD: return "pointCloud";
+	case STAGE_TRIANGULATE: return "triangulate";
+	case STAGE_LATENCY: return "latency";
+	case STAGE_UPDATE_TEXTURE: return "updateTexture";
+	case STAGE_GET_VBO: return "getVbo";
+	case STAGE_LOD: return "lod";
+	case STAGE_TEMPORAL: return "temporal";
+	case STAGE_BACKGROUND: return "background";
+	default: return "unknown";
+	}
+}
+
+//--------------------------------------------------------------------------------
+ofxKinectV2::Stats ofxKinectV2::getStats() const
+{
+	Stats stats;
+	for (int i = 0; i < NUM_STAGES; i++)
+	{
+		auto& histogram = stageHistograms[i];
+		auto& stage = stats.stages[i];
+		stage.count = histogram.getCount();
+		stage.p50 = histogram.getPercentile(0.5);
+		stage.p95 = histogram.getPercentile(0.95);
+		stage.p99 = histogram.getPercentile(0.99);
+		stage.max = histogram.getMax();
+	}
+	stats.framesProcessed = framesProcessed;
+	stats.framesDropped = framesDropped;
+	stats.framesOverwritten = framesOverwritten;
+	return stats;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::resetStats()
+{
+	for (auto& histogram : stageHistograms) histogram.reset();
+	framesProcessed = 0;
+	framesDropped = 0;
+	framesOverwritten = 0;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::onUpdate(ofEventArgs&)
+{
+	uint64_t now = ofGetElapsedTimeMicros();
+	if (!bStatsEnabled || now - lastStatsRefresh < 500000)
 		return;
+	lastStatsRefresh = now;
 
-	waitForThread(true);
-	closeKinect();
-	bOpened = false;
+	Stats stats = getStats();
+	for (int i = 0; i < NUM_STAGES; i++)
+	{
+		auto& stage = stats.stages[i];
+		statsLabels[i] = ofToString(stage.p50) + " / " + ofToString(stage.p95) + " / " + ofToString(stage.p99) + " / " + ofToString(stage.max) + " us";
+	}
+	statsCounters = ofToString(stats.framesProcessed) + " ok, " + ofToString(stats.framesDropped) + " dropped, " + ofToString(stats.framesOverwritten) + " overwritten";
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::notifyFrameReady(int index)
+{
+	// the slot is read only until the worker gets it back, which can't happen before the handlers return
+	FrameEventArgs args;
+	args.info = frameInfos[index];
+	args.color = &frameColor[index];
+	args.ir = &frameIr[index];
+	args.irShort = &frameIrShort[index];
+	args.rawDepth = &frameRawDepth[index];
+	args.depth = &frameDepth[index];
+	args.aligned = &frameAligned[index];
+	args.bigDepth = &frameBigDepth[index];
+	args.userMask = &frameUserMask[index];
+	args.pointCloudVertices = &pcVertices[index];
+	args.pointCloudColors = &pcColors[index];
+	args.pointCloudPackedVertices = &pcPackedVertices[index];
+	args.pointCloudPackedColors = &pcPackedColors[index];
+	args.pointCloudIndices = &pcIndices[index];
+	ofNotifyEvent(frameReadyEvent, args, this);
+}
+
+//--------------------------------------------------------------------------------
+const ofxKinectV2::FrameInfo& ofxKinectV2::getFrameInfo() const
+{
+	return frameInfos[indexFront];
 }
 
-int ofxKinectV2::openKinect(std::string serial)
+//--------------------------------------------------------------------------------
+unsigned int ofxKinectV2::getStreams(unsigned int outputs)
 {
-	//pipeline = new libfreenect2::CpuPacketPipeline();
-	//ofAppGLFWWindow * glfwWindow = (ofAppGLFWWindow*)ofGetWindowPtr();
-	//GLFWwindow* window = glfwWindow->getGLFWWindow();
-	//pipeline = new libfreenect2::OpenGLPacketPipeline(window);
-	pipeline = new libfreenect2::OpenCLPacketPipeline();
+	// point cloud colors mean nothing without the point cloud itself
+	if (!(outputs & OUTPUT_POINT_CLOUD)) outputs &= ~OUTPUT_POINT_CLOUD_COLORS;
+
+	unsigned int streams = 0;
+	if (outputs & (OUTPUT_COLOR | OUTPUT_ALIGNED | OUTPUT_POINT_CLOUD_COLORS | OUTPUT_BIG_DEPTH)) streams |= STREAM_COLOR;
+	if (outputs & (OUTPUT_IR | OUTPUT_RAW_DEPTH | OUTPUT_DEPTH | OUTPUT_ALIGNED | OUTPUT_POINT_CLOUD | OUTPUT_BIG_DEPTH)) streams |= STREAM_DEPTH;
+	return streams;
+}
 
-	if (pipeline)
+//--------------------------------------------------------------------------------
+void ofxKinectV2::setOutputs(unsigned int outputs)
+{
+	// the listener keeps outputMask in sync
+	for (int i = 0; i < NUM_OUTPUTS; i++)
 	{
-		dev = freenect2.openDevice(serial, pipeline);
+		bOutputs[i] = (outputs & (1 << i)) != 0;
 	}
+}
 
-	if (dev == 0)
+//--------------------------------------------------------------------------------
+void ofxKinectV2::onOutputChanged(bool&)
+{
+	unsigned int outputs = 0;
+	for (int i = 0; i < NUM_OUTPUTS; i++)
 	{
-		ofLogError("ofxKinectV2::openKinect") << "failure opening device with serial " << serial;
-		return -1;
+		if (bOutputs[i]) outputs |= 1 << i;
 	}
+	outputMask = outputs;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::startStreams(unsigned int outputs)
+{
+	// a stream that isn't started is never decoded, so a depth only setup never touches the jpeg decoder
+	const unsigned int streams = getStreams(outputs);
+	if (runningStreams)
+	{
+		dev->stop();
+	}
+	runningStreams = 0;
+	lastColorSequence = -1;
+	lastDepthSequence = -1;
 
-	listener = new libfreenect2::SyncMultiFrameListener(libfreenect2::Frame::Color | libfreenect2::Frame::Ir | libfreenect2::Frame::Depth);
+	unsigned int types = 0;
+	if (streams & STREAM_COLOR) types |= libfreenect2::Frame::Color;
+	if (streams & STREAM_DEPTH) types |= libfreenect2::Frame::Ir | libfreenect2::Frame::Depth;
 
+	// the listener only completes a frame set once every requested type is in, so it has to match the streams
+	auto previous = listener;
+	listener = types ? new libfreenect2::SyncMultiFrameListener(types) : nullptr;
 	dev->setColorFrameListener(listener);
 	dev->setIrAndDepthFrameListener(listener);
-	dev->start();
+	delete previous;
 
-	ofLogVerbose("ofxKinectV2::openKinect") << "device serial: " << dev->getSerialNumber();
-	ofLogVerbose("ofxKinectV2::openKinect") << "device firmware: " << dev->getFirmwareVersion();
+	if (!streams)
+		return;
 
-	registration = new libfreenect2::Registration(dev->getIrCameraParams(), dev->getColorCameraParams());
+	if (!dev->startStreams((streams & STREAM_COLOR) != 0, (streams & STREAM_DEPTH) != 0))
+	{
+		ofLogError("ofxKinectV2::startStreams") << "failure starting streams";
+		return;
+	}
+	runningStreams = streams;
 
-	bOpened = true;
+	// the camera parameters are read from the device on the first start
+	if (!registration)
+	{
+		// the tables only change with the device, its firmware or its parameters, so they are kept on disk per serial
+		const std::string serial = dev->getSerialNumber();
+		const std::string cachePath = bTableCache ? ofToDataPath("ofxKinectV2_" + serial + ".tables", true) : "";
+		uint64_t tablesBegin = ofGetElapsedTimeMicros();
+		registration = new ofxKinectV2Registration(dev->getIrCameraParams(), dev->getColorCameraParams(),
+			cachePath, serial + " " + dev->getFirmwareVersion());
+		ofLogVerbose("ofxKinectV2::startStreams") << "registration tables " << (registration->isFromCache() ? "loaded" : "built")
+			<< " in " << (ofGetElapsedTimeMicros() - tablesBegin) / 1000.0f << " ms";
+
+		// per pixel rays for the point cloud, only depend on the ir intrinsics
+		auto irParams = dev->getIrCameraParams();
+		rayX.resize(DEPTH_WIDTH);
+		rayY.resize(DEPTH_HEIGHT);
+		ofxKinectV2Kernels::buildRayTable(irParams.fx, irParams.cx, DEPTH_WIDTH, rayX.data());
+		ofxKinectV2Kernels::buildRayTable(irParams.fy, irParams.cy, DEPTH_HEIGHT, rayY.data());
+	}
+}
 
-	return 0;
+
+//--------------------------------------------------------------------------------
+std::shared_ptr<libfreenect2::Frame> ofxKinectV2::acquirePooledFrame(const std::shared_ptr<FramePool>& source)
+{
+	libfreenect2::Frame* frame = nullptr;
+	{
+		std::lock_guard<std::mutex> guard(source->mutex);
+		if (!source->frames.empty())
+		{
+			frame = source->frames.back();
+			source->frames.pop_back();
+		}
+	}
+	if (!frame) frame = new libfreenect2::Frame(source->width, source->height, 4);
+
+	// the pool outlives us if a consumer still holds a lease
+	auto owner = source;
+	return std::shared_ptr<libfreenect2::Frame>(frame, [owner](libfreenect2::Frame* f)
+	{
+		std::lock_guard<std::mutex> guard(owner->mutex);
+		owner->frames.push_back(f);
+	});
 }
 
-void ofxKinectV2::closeKinect()
+//--------------------------------------------------------------------------------
+std::shared_ptr<ofxKinectV2::FrameLease> ofxKinectV2::getFrameLease()
 {
-	listener->release(frames);
+	return frameLeases[indexFront];
+}
 
-	dev->stop();
-	dev->close();
+//--------------------------------------------------------------------------------
+void ofxKinectV2::publishFrame()
+{
+	// hand the finished back buffer to the mailbox and continue with whatever was parked there.
+	// never blocks, an unread frame in the mailbox is simply overwritten by the newer one
+	int previous = mailbox.exchange(indexBack | MAILBOX_FRESH, std::memory_order_acq_rel);
+	indexBack = previous & MAILBOX_INDEX;
+	if ((previous & MAILBOX_FRESH) && bStatsEnabled) framesOverwritten++;
+}
+
+//--------------------------------------------------------------------------------
+bool ofxKinectV2::latchFrame()
+{
+	if (!(mailbox.load(std::memory_order_acquire) & MAILBOX_FRESH))
+		return false;
+
+	// the worker may get the old front right back, the gpu has to be done reading its upload buffers
+	waitUploadFence(indexFront);
+
+	int previous = mailbox.exchange(indexFront, std::memory_order_acq_rel);
+	indexFront = previous & MAILBOX_INDEX;
+	bFrontUploaded = false;
+	bFrontUnpacked = false;
+	return true;
+}
+
+//--------------------------------------------------------------------------------
+bool ofxKinectV2::acquireFrame()
+{
+	bool bNew = latchFrame();
+	bFrameHeld = true;
+	return bNew;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::releaseFrame()
+{
+	bFrameHeld = false;
+}
+
+//--------------------------------------------------------------------------------
+bool ofxKinectV2::isFrameNew()
+{
+	return !bFrontUploaded || (mailbox.load(std::memory_order_acquire) & MAILBOX_FRESH);
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::onDistanceChanged(float&)
+{
+	bDepthLutDirty = true;
+	if (bClipDepth)
+	{
+		// a slider drag fires on every step, only the value it rests on restarts the streams
+		depthConfigDue = ofGetElapsedTimeMicros() + 300000;
+		bDepthConfigDirty = true;
+	}
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::onDepthConfigChanged(bool&)
+{
+	depthConfigDue = 0;
+	bDepthConfigDirty = true;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::onSubtractBackgroundChanged(bool& subtract)
+{
+	if (subtract) learnBackground();
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::learnBackground()
+{
+	bBackgroundLearned = false;
+	bBackgroundReset = true;
+}
+
+//--------------------------------------------------------------------------------
+bool ofxKinectV2::updateUserMask(const float* depth, ofPixels& mask, std::pair<int, int>& rows)
+{
+	const size_t numPixels = DEPTH_WIDTH * DEPTH_HEIGHT;
+	if (bBackgroundReset.exchange(false))
+	{
+		backgroundSum.assign(numPixels, 0.0f);
+		backgroundCount.assign(numPixels, 0.0f);
+		background.assign(numPixels, 0.0f);
+		backgroundLearnedFrames = 0;
+		bBackgroundLearned = false;
+	}
+
+	if (!bBackgroundLearned)
+	{
+		// mean of the valid samples per pixel, nothing is masked until it is done
+		pool->parallelFor(DEPTH_HEIGHT, [&](size_t begin, size_t end)
+		{
+			const size_t offset = begin * DEPTH_WIDTH;
+			ofxKinectV2Kernels::accumulateBackground(depth + offset, &backgroundSum[offset], &backgroundCount[offset], (end - begin) * DEPTH_WIDTH);
+		});
+		if (++backgroundLearnedFrames >= backgroundFrames)
+		{
+			ofxKinectV2Kernels::finishBackground(backgroundSum.data(), backgroundCount.data(), background.data(), numPixels);
+			bBackgroundLearned = true;
+		}
+		mask.clear();
+		return false;
+	}
+
+	if (mask.getWidth() != DEPTH_WIDTH || mask.getHeight() != DEPTH_HEIGHT) mask.allocate(DEPTH_WIDTH, DEPTH_HEIGHT, 1);
+	const float tolerance = backgroundTolerance;
+	uint8_t* dst = mask.getData();
+	pool->parallelFor(DEPTH_HEIGHT, [&](size_t begin, size_t end)
+	{
+		const size_t offset = begin * DEPTH_WIDTH;
+		ofxKinectV2Kernels::segmentForeground(depth + offset, &background[offset], tolerance, dst + offset, (end - begin) * DEPTH_WIDTH);
+	});
+
+	// first and last rows with a user in them, an empty range when nobody is there
+	int first = 0;
+	int last = DEPTH_HEIGHT;
+	while (first < last && !memchr(dst + first * DEPTH_WIDTH, 255, DEPTH_WIDTH)) first++;
+	while (last > first && !memchr(dst + (last - 1) * DEPTH_WIDTH, 255, DEPTH_WIDTH)) last--;
+	rows = first < last ? std::make_pair(first, last) : std::make_pair(DEPTH_HEIGHT, 0);
+	return true;
+}
+
+//--------------------------------------------------------------------------------
+libfreenect2::Freenect2Device::Config ofxKinectV2::getDepthConfig() const
+{
+	libfreenect2::Freenect2Device::Config config;
+	config.EnableBilateralFilter = bBilateralFilter && !bFastDepth;
+	config.EnableEdgeAwareFilter = bEdgeAwareFilter && !bFastDepth;
+	if (bClipDepth)
+	{
+		// metres
+		config.MinDepth = minDistance * 0.001f;
+		config.MaxDepth = maxDistance * 0.001f;
+	}
+	return config;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::updateDepthLut()
+{
+	// one entry per millimetre over the whole parameter range, same mapping as the old per pixel hsb
+	const int size = (int)minDistance.getMax() + 1;
+	depthLut.resize(size);
+	std::pair<float, float> minmax(0.0, 0.8);
+	for (int i = 0; i < size; i++)
+	{
+		float hue = ofMap(i, minDistance, maxDistance, minmax.first, minmax.second, true);
+		ofColor color(0);
+		if (hue != minmax.first && hue != minmax.second) color = ofFloatColor::fromHsb(hue, 0.9, 0.9);
+		depthLut[i] = color.r | (color.g << 8) | (color.b << 16);
+	}
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::copyBGRX(const libfreenect2::Frame* src, ofPixels& dst)
+{
+	// copy and swap to rgb in one pass
+	if ((dst.getWidth() != src->width) || (dst.getHeight() != src->height) || (dst.getNumChannels() != 4))
+	{
+		dst.allocate(src->width, src->height, 4);
+	}
+	ofxKinectV2Kernels::convertBGRXToRGBA(src->data, dst.getData(), src->width * src->height);
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::copyIr(const libfreenect2::Frame* src, int index)
+{
+	// libfreenect2 delivers ir as float in 0-65535
+	const float* data = reinterpret_cast<const float*>(src->data);
+	if (bUseShortIr)
+	{
+		auto& dst = frameIrShort[index];
+		if ((dst.getWidth() != src->width) || (dst.getHeight() != src->height))
+		{
+			dst.allocate(src->width, src->height, 1);
+		}
+		ofxKinectV2Kernels::convertFloatToShort(data, dst.getData(), src->width * src->height);
+	}
+	else
+	{
+		// downscale to 0-1 while copying
+		auto& dst = frameIr[index];
+		if ((dst.getWidth() != src->width) || (dst.getHeight() != src->height))
+		{
+			dst.allocate(src->width, src->height, 1);
+		}
+		ofxKinectV2Kernels::copyScaled(data, dst.getData(), src->width * src->height, 1.0f / 65535.0f);
+	}
+}
+
+void ofxKinectV2::updateTexture(ofTexture* color, ofTexture* ir, ofTexture* depth, ofTexture* aligned)
+{
+	if (!bFrameHeld) latchFrame();
+	if (bFrontUploaded)
+		return;
+
+	uint64_t stageBegin = beginStage();
+
+	// pixels that live in an upload buffer go up without a cpu copy, the rest through loadData
+	bool bBuffered = false;
+	if (frameColor[indexFront].isAllocated() && color)
+	{
+		if (loadFromUploadBuffer(*color, frameColor[indexFront], uploadColor[indexFront], GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE)) bBuffered = true;
+		else color->loadData(frameColor[indexFront]);
+	}
+
+	if (ir)
+	{
+		if (bUseShortIr && frameIrShort[indexFront].isAllocated())
+		{
+			if (loadFromUploadBuffer(*ir, frameIrShort[indexFront], uploadIr[indexFront], GL_R16, GL_RED, GL_UNSIGNED_SHORT)) bBuffered = true;
+			else ir->loadData(frameIrShort[indexFront]);
+		}
+		else if (!bUseShortIr && frameIr[indexFront].isAllocated())
+		{
+			if (loadFromUploadBuffer(*ir, frameIr[indexFront], uploadIr[indexFront], GL_R32F, GL_RED, GL_FLOAT)) bBuffered = true;
+			else ir->loadData(frameIr[indexFront]);
+		}
+	}
+
+	if (frameDepth[indexFront].isAllocated() && depth)
+	{
+		if (loadFromUploadBuffer(*depth, frameDepth[indexFront], uploadDepth[indexFront], GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE)) bBuffered = true;
+		else depth->loadData(frameDepth[indexFront]);
+	}
+
+	if (frameAligned[indexFront].isAllocated() && aligned)
+	{
+		if (loadFromUploadBuffer(*aligned, frameAligned[indexFront], uploadAligned[indexFront], GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE)) bBuffered = true;
+		else aligned->loadData(frameAligned[indexFront]);
+	}
+
+	if (bBuffered)
+	{
+		waitUploadFence(indexFront);
+		uploadFences[indexFront] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	bFrontUploaded = true;
+	endStage(STAGE_UPDATE_TEXTURE, stageBegin);
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::allocateUploadBuffers(unsigned int outputs)
+{
+	if (!GLEW_ARB_buffer_storage)
+	{
+		ofLogNotice("ofxKinectV2::allocateUploadBuffers") << "no persistent buffer mapping, uploading through loadData";
+		return;
+	}
+
+	// sized for the largest format of each product, ir short fits in the float one
+	for (int i = 0; i < NUM_BUFFERS; i++)
+	{
+		if (outputs & OUTPUT_COLOR) allocateUploadBuffer(uploadColor[i], COLOR_WIDTH * COLOR_HEIGHT * 4);
+		if (outputs & OUTPUT_IR) allocateUploadBuffer(uploadIr[i], DEPTH_WIDTH * DEPTH_HEIGHT * sizeof(float));
+		if (outputs & OUTPUT_DEPTH) allocateUploadBuffer(uploadDepth[i], DEPTH_WIDTH * DEPTH_HEIGHT * 3);
+		if (outputs & OUTPUT_ALIGNED) allocateUploadBuffer(uploadAligned[i], DEPTH_WIDTH * DEPTH_HEIGHT * 4);
+	}
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::allocateUploadBuffer(UploadBuffer& upload, size_t size)
+{
+	// read too so the driver keeps it in cached memory, the worker's copies and the frame event read it back
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	upload.buffer.allocate();
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.buffer.getId());
+	glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+	upload.mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	upload.size = upload.mapped ? size : 0;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::freeUploadBuffers()
+{
+	for (int i = 0; i < NUM_BUFFERS; i++)
+	{
+		waitUploadFence(i);
+
+		// no views may outlive the mapping
+		if (uploadColor[i].mapped && frameColor[i].getData() == uploadColor[i].mapped) frameColor[i].clear();
+		if (uploadIr[i].mapped && (void*)frameIr[i].getData() == uploadIr[i].mapped) frameIr[i].clear();
+		if (uploadIr[i].mapped && (void*)frameIrShort[i].getData() == uploadIr[i].mapped) frameIrShort[i].clear();
+		if (uploadDepth[i].mapped && frameDepth[i].getData() == uploadDepth[i].mapped) frameDepth[i].clear();
+		if (uploadAligned[i].mapped && frameAligned[i].getData() == uploadAligned[i].mapped) frameAligned[i].clear();
+
+		for (auto upload : { &uploadColor[i], &uploadIr[i], &uploadDepth[i], &uploadAligned[i] })
+		{
+			if (upload->mapped)
+			{
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload->buffer.getId());
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+			*upload = UploadBuffer();
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------
+template<class T>
+void ofxKinectV2::bindUploadView(ofPixels_<T>& pixels, const UploadBuffer& upload, size_t width, size_t height, size_t channels)
+{
+	// point the slot pixels at the mapped buffer, the copy that follows then writes straight into it
+	if (!upload.mapped || width * height * channels * sizeof(T) > upload.size)
+		return;
+	if (pixels.getData() == upload.mapped && pixels.getWidth() == width && pixels.getHeight() == height && pixels.getNumChannels() == channels)
+		return;
+	pixels.setFromExternalPixels((T*)upload.mapped, width, height, channels);
+}
+
+//--------------------------------------------------------------------------------
+template<class T>
+bool ofxKinectV2::loadFromUploadBuffer(ofTexture& texture, const ofPixels_<T>& pixels, const UploadBuffer& upload, int glInternalFormat, int glFormat, int glType)
+{
+	if (!upload.mapped || (const void*)pixels.getData() != upload.mapped)
+		return false;
+
+	auto& data = texture.getTextureData();
+	if (!texture.isAllocated() || data.width != (int)pixels.getWidth() || data.height != (int)pixels.getHeight() || data.glInternalFormat != glInternalFormat)
+	{
+		texture.allocate(pixels.getWidth(), pixels.getHeight(), glInternalFormat);
+	}
+	texture.loadData(upload.buffer, glFormat, glType);
+	return true;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::waitUploadFence(int index)
+{
+	GLsync& fence = uploadFences[index];
+	if (!fence)
+		return;
+
+	// normally long passed by the time the slot is recycled
+	glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+	glDeleteSync(fence);
+	fence = 0;
+}
+
+ofShortPixels& ofxKinectV2::getIrShortPixels()
+{
+	return frameIrShort[indexFront];
+}
+
+ofFloatPixels& ofxKinectV2::getBigDepthPixels()
+{
+	return frameBigDepth[indexFront];
+}
+
+ofPixels& ofxKinectV2::getUserMaskPixels()
+{
+	return frameUserMask[indexFront];
+}
+
+std::vector<ofVec4f>& ofxKinectV2::getPointCloudVertices(Lod lod)
+{
+	if (lod != LOD_FULL)
+		return getLodMesh(lod).vertices;
+	if (pcPackedVertices[indexFront].empty())
+		return pcVertices[indexFront];
+	unpackPointCloud();
+	return pcUnpackedVertices;
+}
+
+std::vector<ofFloatColor>& ofxKinectV2::getPointCloudColors(Lod lod)
+{
+	if (lod != LOD_FULL)
+		return getLodMesh(lod).colors;
+	if (pcPackedVertices[indexFront].empty())
+		return pcColors[indexFront];
+	unpackPointCloud();
+	return pcUnpackedColors;
+}
+
+std::vector<uint32_t>& ofxKinectV2::getPointCloudIndices(Lod lod)
+{
+	if (lod != LOD_FULL)
+		return getLodMesh(lod).indices;
+	return pcIndices[indexFront];
+}
+
+std::vector<uint16_t>& ofxKinectV2::getPointCloudPackedVertices()
+{
+	return pcPackedVertices[indexFront];
+}
+
+std::vector<uint32_t>& ofxKinectV2::getPointCloudPackedColors()
+{
+	return pcPackedColors[indexFront];
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::unpackPointCloud()
+{
+	if (bFrontUnpacked)
+		return;
+	bFrontUnpacked = true;
+
+	// the front slot is ours, so the float copy lives outside the slots where the worker never looks
+	auto& packedVertices = pcPackedVertices[indexFront];
+	auto& packedColors = pcPackedColors[indexFront];
+	const size_t numPoints = packedVertices.size() / 4;
+	pcUnpackedVertices.resize(numPoints);
+	pcUnpackedColors.resize(packedColors.empty() ? 0 : numPoints);
+	ofxKinectV2Kernels::unpackPointCloud(packedVertices.data(), packedColors.data(), numPoints,
+		&pcUnpackedVertices[0].x, packedColors.empty() ? nullptr : &pcUnpackedColors[0].r);
+}
+
+//--------------------------------------------------------------------------------
+ofxKinectV2::LodMesh& ofxKinectV2::getLodMesh(Lod lod)
+{
+	// the derive stage builds the level into every frame from the next one on
+	lodRequestTime[lod] = ofGetElapsedTimeMillis();
+	return lodMeshes[indexFront * NUM_LODS + lod];
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::buildLods(bool bPointCloud)
+{
+	// derive stage: the reduced levels asked for within the last second, the others are freed
+	const uint64_t now = ofGetElapsedTimeMillis();
+	bool bAnyLod = false;
+	bool bWanted[NUM_LODS] = {};
+	for (int lod = LOD_FULL + 1; lod < NUM_LODS; lod++)
+	{
+		const uint64_t requested = lodRequestTime[lod];
+		bWanted[lod] = bPointCloud && requested && requested + 1000 > now;
+		bAnyLod |= bWanted[lod];
+		if (!bWanted[lod])
+		{
+			LodMesh& mesh = lodMeshes[indexBack * NUM_LODS + lod];
+			vector<ofVec4f>().swap(mesh.vertices);
+			vector<ofFloatColor>().swap(mesh.colors);
+			vector<ofVec2f>().swap(mesh.texCoords);
+			vector<uint32_t>().swap(mesh.indices);
+		}
+	}
+	if (!bAnyLod)
+		return;
+
+	// from the float cloud, so the packed layout gets unpacked into scratch first
+	const std::vector<ofVec4f>* vertices = &pcVertices[indexBack];
+	const std::vector<ofFloatColor>* colors = &pcColors[indexBack];
+	auto& packedVertices = pcPackedVertices[indexBack];
+	auto& packedColors = pcPackedColors[indexBack];
+	if (!packedVertices.empty())
+	{
+		const size_t numPoints = packedVertices.size() / 4;
+		lodVertices.resize(numPoints);
+		lodColors.resize(packedColors.empty() ? 0 : numPoints);
+		ofxKinectV2Kernels::unpackPointCloud(packedVertices.data(), packedColors.data(), numPoints,
+			&lodVertices[0].x, packedColors.empty() ? nullptr : &lodColors[0].r);
+		vertices = &lodVertices;
+		colors = &lodColors;
+	}
+
+	for (int lod = LOD_FULL + 1; lod < NUM_LODS; lod++)
+	{
+		if (bWanted[lod]) buildLod((Lod)lod, *vertices, *colors, lodMeshes[indexBack * NUM_LODS + lod]);
+	}
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::buildLod(Lod lod, const std::vector<ofVec4f>& vertices, const std::vector<ofFloatColor>& colors, LodMesh& mesh)
+{
+	mesh.vertices.clear();
+	mesh.colors.clear();
+	mesh.texCoords.clear();
+	mesh.indices.clear();
+
+	const size_t numPoints = DEPTH_WIDTH * DEPTH_HEIGHT;
+	if (vertices.size() != numPoints)
+		return;
+	const bool bColors = colors.size() == numPoints;
+
+	uint64_t stageBegin = beginStage();
+
+	// millimetre depth back from the vertices, invalid points are 0 like in the undistorted frame
+	lodDepth.resize(numPoints);
+	for (size_t i = 0; i < numPoints; i++)
+	{
+		float z = vertices[i].z;
+		lodDepth[i] = z < 0.0f ? z * -1000.0f : 0.0f;
+	}
+
+	auto addPoint = [&](size_t x, size_t y)
+	{
+		size_t i = y * DEPTH_WIDTH + x;
+		mesh.vertices.push_back(vertices[i]);
+		if (bColors) mesh.colors.push_back(colors[i]);
+		// same texcoords as the full vbo
+		mesh.texCoords.emplace_back((float)x / DEPTH_HEIGHT, (float)y / DEPTH_HEIGHT);
+	};
+
+	if (lod == LOD_ADAPTIVE)
+	{
+		const size_t numStrips = (DEPTH_HEIGHT - 1 + LOD_MAX_BLOCK - 1) / LOD_MAX_BLOCK;
+		const float tolerance = lodTolerance;
+		triangulateRows(numStrips, LOD_MAX_BLOCK * (DEPTH_WIDTH - 1) * 6, [&](size_t stripBegin, size_t stripEnd, uint32_t* out)
+		{
+			return ofxKinectV2Kernels::triangulateDepthAdaptive(lodDepth.data(), DEPTH_WIDTH, DEPTH_HEIGHT, LOD_MAX_BLOCK,
+				MESH_MAX_NEAR, tolerance, stripBegin, stripEnd, out);
+		}, lodScratch, mesh.indices);
+
+		// keep only the points the triangles use, in pixel order
+		lodRemap.assign(numPoints, 0);
+		for (auto index : mesh.indices) lodRemap[index] = 1;
+		uint32_t numUsed = 0;
+		for (size_t i = 0; i < numPoints; i++)
+		{
+			if (!lodRemap[i])
+				continue;
+			lodRemap[i] = numUsed++;
+			addPoint(i % DEPTH_WIDTH, i / DEPTH_WIDTH);
+		}
+		for (auto& index : mesh.indices) index = lodRemap[index];
+	}
+	else
+	{
+		const size_t step = lod == LOD_HALF ? 2 : 4;
+		const size_t width = DEPTH_WIDTH / step;
+		const size_t height = DEPTH_HEIGHT / step;
+		mesh.vertices.reserve(width * height);
+		mesh.texCoords.reserve(width * height);
+		if (bColors) mesh.colors.reserve(width * height);
+		lodGridDepth.resize(width * height);
+		for (size_t y = 0; y < height; y++)
+		{
+			for (size_t x = 0; x < width; x++)
+			{
+				addPoint(x * step, y * step);
+				lodGridDepth[y * width + x] = lodDepth[y * step * DEPTH_WIDTH + x * step];
+			}
+		}
+
+		// neighbours are step pixels apart now, so are the edges the full mesh would allow
+		mesh.indices.resize((width - 1) * (height - 1) * 6);
+		mesh.indices.resize(ofxKinectV2Kernels::triangulateDepth(lodGridDepth.data(), nullptr, width, 1, height,
+			MESH_MAX_NEAR * step, mesh.indices.data()));
+	}
+	endStage(STAGE_LOD, stageBegin);
+}
+
+//--------------------------------------------------------------------------------
+bool ofxKinectV2::updateLodMesh(ofVbo& vbo, Lod lod)
+{
+	LodMesh& mesh = getLodMesh(lod);
+	if (mesh.vertices.empty())
+		return false;
+
+	uint64_t stageBegin = beginStage();
+	setupMesh();
+
+	// the size changes with the level and, for LOD_ADAPTIVE, every frame, so the attributes are set up every time.
+	// a packed vbo shares its buffers with the full level and is started over
+	if (packedVertexBuffer.isAllocated() && vbo.getVertexBuffer().getId() == packedVertexBuffer.getId())
+	{
+		vbo.clear();
+	}
+	const int numVertices = mesh.vertices.size();
+	vbo.setVertexData(&mesh.vertices[0].x, 4, numVertices, GL_STREAM_DRAW);
+	vbo.setTexCoordData(&mesh.texCoords[0], numVertices, GL_STREAM_DRAW);
+	if (!mesh.colors.empty()) vbo.setColorData(&mesh.colors[0], numVertices, GL_STREAM_DRAW);
+	else if (vbo.getUsingColors()) vbo.disableColors();
+
+	// each level has its own index buffer, which also tells drawMesh() which level a vbo holds.
+	// it only grows, so the vbo keeps pointing at the same buffer object
+	MeshBuffers& buffers = meshBuffers[lod];
+	const size_t indexBytes = mesh.indices.size() * sizeof(uint32_t);
+	if (buffers.indices.size() < indexBytes) buffers.indices.allocate(indexBytes, GL_STREAM_DRAW);
+	if (indexBytes) buffers.indices.updateData(0, indexBytes, mesh.indices.data());
+	vbo.setIndexBuffer(buffers.indices);
+
+	buffers.indexCount = mesh.indices.size();
+	uint32_t command[5] = { (uint32_t)buffers.indexCount, 1, 0, 0, 0 };
+	buffers.drawCommand.updateData(0, sizeof(command), command);
+	endStage(STAGE_GET_VBO, stageBegin);
+
+	return true;
+}
+
+//--------------------------------------------------------------------------------
+bool ofxKinectV2::updateMesh(ofVbo& vbo, Lod lod)
+{
+	if (!bFrameHeld) latchFrame();
+	if (lod != LOD_FULL)
+		return updateLodMesh(vbo, lod);
+
+	auto& vertices = pcVertices[indexFront];
+	auto& colors = pcColors[indexFront];
+	auto& packedVertices = pcPackedVertices[indexFront];
+	auto& packedColors = pcPackedColors[indexFront];
+	const bool bPacked = !packedVertices.empty();
+	if (vertices.empty() && !bPacked)
+		return false;
+
+	uint64_t stageBegin = beginStage();
+	setupMesh();
+
+	// a vbo set up for the other layout or another lod starts over
+	MeshBuffers& buffers = meshBuffers[LOD_FULL];
+	const bool bVboPacked = packedVertexBuffer.isAllocated() && vbo.getVertexBuffer().getId() == packedVertexBuffer.getId();
+	if (vbo.getIsAllocated() && (bVboPacked != bPacked || vbo.getIndexId() != buffers.indices.getId() ||
+		vbo.getNumVertices() != DEPTH_WIDTH * DEPTH_HEIGHT))
+	{
+		vbo.clear();
+	}
+
+	if (!vbo.getIsAllocated())
+	{
+		vector<ofVec2f> texCoords;
+		for (int y = 0; y < DEPTH_HEIGHT; y++)
+		{
+			float coord_y = (float)y / DEPTH_HEIGHT;
+			for (int x = 0; x < DEPTH_WIDTH; x++)
+			{
+				float coord_x = (float)x / DEPTH_HEIGHT;
+				texCoords.emplace_back(coord_x, coord_y);
+			}
+		}
+		vbo.setTexCoordData(&texCoords[0], texCoords.size(), GL_STATIC_DRAW);
+		if (!bPacked)
+		{
+			vbo.setVertexData(&vertices[0].x, 4, vertices.size(), GL_DYNAMIC_DRAW);
+			uploadedVertexBuffer = 0;
+		}
+		vbo.setIndexBuffer(buffers.indices);
+	}
+
+	// colors are optional, see OUTPUT_POINT_CLOUD_COLORS
+	if (bPacked)
+	{
+		uploadPackedPointCloud(vbo, packedVertices, packedColors);
+	}
+	else
+	{
+		const bool bFull = uploadedVertexBuffer == 0;
+		const std::pair<int, int> rows = getUploadRows(vbo.getVertexBuffer().getId());
+		const size_t first = rows.first * DEPTH_WIDTH;
+		const size_t count = rows.first < rows.second ? (rows.second - rows.first) * DEPTH_WIDTH : 0;
+		if (!bFull && count) vbo.getVertexBuffer().updateData(first * sizeof(ofVec4f), count * sizeof(ofVec4f), &vertices[first]);
+
+		// the colors of background points aren't drawn, a color buffer only needs the full upload on creation
+		if (!colors.empty())
+		{
+			if (!vbo.getUsingColors()) vbo.setColorData(&colors[0], colors.size(), GL_DYNAMIC_DRAW);
+			else if (count) vbo.getColorBuffer().updateData(first * sizeof(ofFloatColor), count * sizeof(ofFloatColor), &colors[first]);
+		}
+	}
+
+	uint32_t command[5] = { 0, 1, 0, 0, 0 };
+	buffers.indexCount = 0;
+	auto& indices = pcIndices[indexFront];
+	auto& depth = frameUndistorted[indexFront];
+	if (!indices.empty())
+	{
+		// triangulated by the worker already
+		buffers.indices.updateData(0, indices.size() * sizeof(uint32_t), indices.data());
+		buffers.indexCount = indices.size();
+		command[0] = buffers.indexCount;
+		buffers.drawCommand.updateData(0, sizeof(command), command);
+	}
+	else if (depth.getWidth() && depth.getHeight())
+	{
+		// compiled on first use, cpu triangulation doesn't need GL 4.3
+		if (!computeIndices.isLoaded())
+		{
+			computeIndices.setupShaderFromSource(GL_COMPUTE_SHADER, comp_glsl);
+			computeIndices.linkProgram();
+		}
+		depthTexture.loadData(&depth[0], DEPTH_WIDTH, DEPTH_HEIGHT, GL_RED);
+		buffers.drawCommand.updateData(0, sizeof(command), command);
+		auto& userMask = frameUserMask[indexFront];
+		const bool bUser = userMask.isAllocated();
+		if (bUser)
+		{
+			userTexture.loadData(userMask.getData(), DEPTH_WIDTH, DEPTH_HEIGHT, GL_RED);
+			userTexture.bindAsImage(1, GL_READ_ONLY);
+		}
+		
+		depthTexture.bindAsImage(0, GL_READ_ONLY);
+		buffers.indices.bindBase(GL_SHADER_STORAGE_BUFFER, 0);
+		buffers.drawCommand.bindBase(GL_SHADER_STORAGE_BUFFER, 1);
+
+		computeIndices.begin();
+		computeIndices.setUniform1i("bUseUserMap", bUser ? 1 : 0);
+		computeIndices.dispatchCompute(DEPTH_WIDTH / 32, DEPTH_HEIGHT / 8, 1);
+		computeIndices.end();
+
+		buffers.indices.unbindBase(GL_SHADER_STORAGE_BUFFER, 0);
+		buffers.drawCommand.unbindBase(GL_SHADER_STORAGE_BUFFER, 1);
+
+		// the indices and the count are consumed by the draw, nothing is read back here
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT);
+		buffers.indexCount = -1;
+	}
+	else
+	{
+		buffers.drawCommand.updateData(0, sizeof(command), command);
+	}
+	endStage(STAGE_GET_VBO, stageBegin);
+
+	return true;
+}
+
+//--------------------------------------------------------------------------------
+int ofxKinectV2::getVbo(ofVbo& vbo, Lod lod)
+{
+	if (!updateMesh(vbo, lod))
+		return 0;
+	MeshBuffers& buffers = meshBuffers[lod];
+	if (buffers.indexCount >= 0)
+		return buffers.indexCount;
+
+	// only the compute shader knows the count, mapping it waits for the dispatch
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	auto command = buffers.drawCommand.map<uint32_t>(GL_READ_ONLY);
+	int numIndices = command[0];
+	buffers.drawCommand.unmap();
+	return numIndices;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::drawMesh(const ofVbo& vbo)
+{
+	if (!bMeshSetup || !vbo.getIsAllocated())
+		return;
+
+	// the index buffer tells which level the vbo was last updated with
+	const MeshBuffers* buffers = nullptr;
+	for (auto& level : meshBuffers)
+	{
+		if (level.indices.getId() == vbo.getIndexId()) buffers = &level;
+	}
+	if (!buffers)
+		return;
+
+	// the renderer binds its shader, matrices and attribute flags the same way for its own vbo draws
+	auto renderer = std::dynamic_pointer_cast<ofGLProgrammableRenderer>(ofGetCurrentRenderer());
+	if (!renderer)
+	{
+		ofLogError("ofxKinectV2::drawMesh") << "glDrawElementsIndirect needs the programmable renderer";
+		return;
+	}
+	renderer->setAttributes(true, vbo.getUsingColors(), vbo.getUsingTexCoords(), false);
+
+	// a packed vbo is drawn from our vao, its own one describes the attributes as floats
+	const bool bPacked = packedVao && vbo.getVertexBuffer().getId() == packedVertexBuffer.getId();
+	if (bPacked) glBindVertexArray(packedVao);
+	else vbo.bind();
+	buffers->indices.bind(GL_ELEMENT_ARRAY_BUFFER);
+	buffers->drawCommand.bind(GL_DRAW_INDIRECT_BUFFER);
+	glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr);
+	buffers->drawCommand.unbind(GL_DRAW_INDIRECT_BUFFER);
+	if (bPacked) glBindVertexArray(0);
+	else vbo.unbind();
+}
+
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::uploadPackedPointCloud(ofVbo& vbo, const std::vector<uint16_t>& vertices, const std::vector<uint32_t>& colors)
+{
+	const size_t vertexBytes = vertices.size() * sizeof(uint16_t);
+	if (!packedVertexBuffer.isAllocated() || packedVertexBuffer.size() != vertexBytes)
+	{
+		packedVertexBuffer.allocate(vertexBytes, GL_STREAM_DRAW);
+		uploadedVertexBuffer = 0;
+	}
+	const std::pair<int, int> rows = getUploadRows(packedVertexBuffer.getId());
+	const size_t first = rows.first * DEPTH_WIDTH;
+	const size_t count = rows.first < rows.second ? (rows.second - rows.first) * DEPTH_WIDTH : 0;
+	if (count) packedVertexBuffer.updateData(first * 4 * sizeof(uint16_t), count * 4 * sizeof(uint16_t), &vertices[first * 4]);
+	if (vbo.getVertexBuffer().getId() != packedVertexBuffer.getId())
+	{
+		vbo.setVertexBuffer(packedVertexBuffer, 4, 4 * sizeof(uint16_t));
+	}
+
+	if (!colors.empty())
+	{
+		const size_t colorBytes = colors.size() * sizeof(uint32_t);
+		if (!packedColorBuffer.isAllocated() || packedColorBuffer.size() != colorBytes)
+		{
+			packedColorBuffer.allocate(colorBytes, GL_STREAM_DRAW);
+			packedColorBuffer.updateData(0, colorBytes, colors.data());
+		}
+		else if (count) packedColorBuffer.updateData(first * sizeof(uint32_t), count * sizeof(uint32_t), &colors[first]);
+		if (vbo.getColorBuffer().getId() != packedColorBuffer.getId())
+		{
+			vbo.setColorBuffer(packedColorBuffer, sizeof(uint32_t));
+		}
+	}
+	else if (vbo.getUsingColors()) vbo.disableColors();
+
+	// ofVbo only sets up float attributes and re-specifies its vao as floats whenever it binds it after a change,
+	// so the packed types live in a vao of our own that drawMesh() binds instead
+	if (!packedVao) glGenVertexArrays(1, &packedVao);
+	glBindVertexArray(packedVao);
+	packedVertexBuffer.bind(GL_ARRAY_BUFFER);
+	glEnableVertexAttribArray(ofShader::POSITION_ATTRIBUTE);
+	glVertexAttribPointer(ofShader::POSITION_ATTRIBUTE, 4, GL_HALF_FLOAT, GL_FALSE, 4 * sizeof(uint16_t), 0);
+	if (!colors.empty())
+	{
+		packedColorBuffer.bind(GL_ARRAY_BUFFER);
+		glEnableVertexAttribArray(ofShader::COLOR_ATTRIBUTE);
+		glVertexAttribPointer(ofShader::COLOR_ATTRIBUTE, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(uint32_t), 0);
+	}
+	else glDisableVertexAttribArray(ofShader::COLOR_ATTRIBUTE);
+	vbo.getTexCoordBuffer().bind(GL_ARRAY_BUFFER);
+	glEnableVertexAttribArray(ofShader::TEXCOORD_ATTRIBUTE);
+	glVertexAttribPointer(ofShader::TEXCOORD_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, sizeof(ofVec2f), 0);
+	meshBuffers[LOD_FULL].indices.bind(GL_ELEMENT_ARRAY_BUFFER);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//--------------------------------------------------------------------------------
+std::pair<int, int> ofxKinectV2::getUploadRows(GLuint vertexBuffer)
+{
+	const std::pair<int, int> rows = frameUserRows[indexFront];
+	std::pair<int, int> upload(0, DEPTH_HEIGHT);
+	if (vertexBuffer == uploadedVertexBuffer)
+	{
+		upload.first = std::min(rows.first, uploadedRows.first);
+		upload.second = std::max(rows.second, uploadedRows.second);
+	}
+	uploadedVertexBuffer = vertexBuffer;
+	uploadedRows = rows;
+	return upload;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::close() {
+	if (!bOpened)
+		return;
+
+	// stop acquiring, then let the later stages drain what is already in flight
+	waitForThread(true);
+	acquiredQueue.close();
+	if (registerThread.joinable()) registerThread.join();
+	if (deriveThread.joinable()) deriveThread.join();
+	closeKinect();
+	freeUploadBuffers();
+	bOpened = false;
+
+	// drop zero copy views before their frames go away
+	for (int i = 0; i < NUM_BUFFERS; i++)
+	{
+		if (!frameLeases[i]) continue;
+		frameColor[i].clear();
+		frameIr[i].clear();
+		frameRawDepth[i].clear();
+		frameAligned[i].clear();
+		frameBigDepth[i].clear();
+		frameUndistorted[i].clear();
+		frameLeases[i].reset();
+	}
+}
+
+int ofxKinectV2::openKinect(std::string serial, Pipeline type)
+{
+	pipelineMs = 0;
+	if (type == PIPELINE_AUTO)
+	{
+		type = readPipelineCache();
+		if (type != PIPELINE_AUTO)
+		{
+			ofLogNotice("ofxKinectV2::openKinect") << "cached pipeline " << getPipelineName(type) << ", " << pipelineMs << " ms per depth packet";
+		}
+		else
+		{
+			type = benchmarkPipelines();
+			if (type != PIPELINE_AUTO) writePipelineCache(type, pipelineMs);
+		}
+	}
+
+	dev = 0;
+	pipeline = createPipeline(type);
+	if (!pipeline)
+	{
+		ofLogError("ofxKinectV2::openKinect") << "the " << getPipelineName(type) << " pipeline isn't available in this build";
+		return -1;
+	}
+
+	// the device owns the pipeline from here on, also when opening fails
+	dev = freenect2.openDevice(serial, pipeline);
+	if (dev == 0)
+	{
+		pipeline = 0;
+		ofLogError("ofxKinectV2::openKinect") << "failure opening device with serial " << serial << " on the " << getPipelineName(type) << " pipeline";
+		return -1;
+	}
+	pipelineType = type;
+
+	dev->setConfiguration(getDepthConfig());
+	bDepthConfigDirty = false;
+
+	// only the streams the outputs need, the worker restarts them when the outputs change
+	startStreams(outputMask);
+
+	ofLogVerbose("ofxKinectV2::openKinect") << "device serial: " << dev->getSerialNumber();
+	ofLogVerbose("ofxKinectV2::openKinect") << "device firmware: " << dev->getFirmwareVersion();
+
+	bOpened = true;
+
+	return 0;
+}
+
+//--------------------------------------------------------------------------------
+const char* ofxKinectV2::getPipelineName(Pipeline pipeline)
+{
+	switch (pipeline)
+	{
+	case PIPELINE_AUTO: return "auto";
+	case PIPELINE_CPU: return "cpu";
+	case PIPELINE_OPENGL: return "opengl";
+	case PIPELINE_OPENCL: return "opencl";
+	case PIPELINE_CPU_SIMD: return "cpu-simd";
+	default: return "";
+	}
+}
+
+//--------------------------------------------------------------------------------
+libfreenect2::PacketPipeline* ofxKinectV2::createPipeline(Pipeline type)
+{
+	// nullptr for the ones this build of libfreenect2 doesn't have
+	switch (type)
+	{
+	case PIPELINE_CPU: return new libfreenect2::CpuPacketPipeline();
+#ifdef LIBFREENECT2_WITH_OPENGL_SUPPORT
+	case PIPELINE_OPENGL: return new libfreenect2::OpenGLPacketPipeline(glfwGetCurrentContext());
+#endif
+#ifdef LIBFREENECT2_WITH_OPENCL_SUPPORT
+	case PIPELINE_OPENCL: return new libfreenect2::OpenCLPacketPipeline();
+#endif
+#if OFXKINECTV2_DEPTH_PROCESSOR
+	case PIPELINE_CPU_SIMD: return new ofxKinectV2DepthPipeline(depthThreads);
+#endif
+	default: return nullptr;
+	}
+}
+
+//--------------------------------------------------------------------------------
+bool ofxKinectV2::recordDepthPackets(const std::string& path, int numPackets)
+{
+#if OFXKINECTV2_DEPTH_PROCESSOR
+	if (dev && pipeline && pipelineType == PIPELINE_CPU_SIMD)
+	{
+		ofxKinectV2DepthProcessor* processor = static_cast<ofxKinectV2DepthProcessor*>(pipeline->getDepthPacketProcessor());
+		return processor->record(ofToDataPath(path, true), numPackets);
+	}
+#endif
+	return false;
+}
+
+//--------------------------------------------------------------------------------
+// hands every frame back to the processor, the benchmark only times the decode
+class DiscardFrameListener : public libfreenect2::FrameListener {
+public:
+	virtual bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame* frame) { return false; }
+};
+
+//--------------------------------------------------------------------------------
+ofxKinectV2::Pipeline ofxKinectV2::benchmarkPipelines()
+{
+	// gpu ones first, they keep a tie since they leave the cpu to the app
+	const Pipeline candidates[] = { PIPELINE_OPENCL, PIPELINE_OPENGL, PIPELINE_CPU_SIMD, PIPELINE_CPU };
+	const int warmupPackets = 2;
+	const int measurePackets = 10;
+	const uint64_t measureMicros = 500000;
+	const size_t packetSize = ofxKinectV2DepthDecoder::PACKET_SIZE;
+
+	// a wall and a disc as the device would see them, not noise: the cpu decoders' filters and unwrapping branch on
+	// the values. the timing is good to pick a decoder on this host, a busier scene (more edges, more invalid pixels)
+	// moves the cpu ones by some percent, the tie margin below covers that
+	ofxKinectV2DepthDecoder::Scene scene;
+	ofxKinectV2DepthDecoder::makeScene(scene);
+	typedef libfreenect2::protocol::P0TablesResponse P0TablesResponse;
+	const size_t numPixels = DEPTH_WIDTH * DEPTH_HEIGHT;
+	std::vector<unsigned char> p0Response(sizeof(P0TablesResponse));
+	memcpy(&p0Response[offsetof(P0TablesResponse, p0table0)], &scene.p0[0], numPixels * sizeof(uint16_t));
+	memcpy(&p0Response[offsetof(P0TablesResponse, p0table1)], &scene.p0[numPixels], numPixels * sizeof(uint16_t));
+	memcpy(&p0Response[offsetof(P0TablesResponse, p0table2)], &scene.p0[numPixels * 2], numPixels * sizeof(uint16_t));
+
+	DiscardFrameListener discard;
+	Pipeline best = PIPELINE_AUTO;
+	float bestMs = 0;
+	for (Pipeline candidate : candidates)
+	{
+		libfreenect2::PacketPipeline* trialPipeline = createPipeline(candidate);
+		if (!trialPipeline) continue;
+
+		libfreenect2::DepthPacketProcessor* processor = trialPipeline->getDepthPacketProcessor();
+		if (!processor->good())
+		{
+			ofLogWarning("ofxKinectV2::benchmarkPipelines") << getPipelineName(candidate) << ": failure initializing the depth decoder";
+			delete trialPipeline;
+			continue;
+		}
+		processor->setFrameListener(&discard);
+		processor->setConfiguration(getDepthConfig());
+		processor->loadP0TablesFromCommandResponse(p0Response.data(), p0Response.size());
+		processor->loadXZTables(scene.xTable.data(), scene.zTable.data());
+		processor->loadLookupTable(scene.lut.data());
+
+		// the gpu decoders want their packets in their own buffers
+		libfreenect2::DepthPacket packet = {};
+		processor->allocateBuffer(packet, packetSize);
+		std::vector<unsigned char> ownBuffer;
+		if (packet.memory && packet.memory->data)
+		{
+			packet.buffer = packet.memory->data;
+		}
+		else
+		{
+			ownBuffer.resize(packetSize);
+			packet.buffer = ownBuffer.data();
+		}
+		memcpy(packet.buffer, scene.packet.data(), packetSize);
+		packet.buffer_length = packetSize;
+
+		// on a thread of its own like the device's async processor, the opengl decoder makes its context current
+		float ms = 0;
+		std::thread([&] {
+			for (int i = 0; i < warmupPackets; i++) processor->process(packet);
+			const uint64_t begin = ofGetElapsedTimeMicros();
+			int count = 0;
+			do {
+				processor->process(packet);
+				count++;
+			} while (count < measurePackets && ofGetElapsedTimeMicros() - begin < measureMicros);
+			ms = (ofGetElapsedTimeMicros() - begin) / 1000.0f / count;
+		}).join();
+
+		processor->releaseBuffer(packet);
+		delete trialPipeline;
+
+		ofLogNotice("ofxKinectV2::benchmarkPipelines") << getPipelineName(candidate) << ": " << ms << " ms per depth packet";
+		// within 10% counts as a tie
+		if (best == PIPELINE_AUTO || ms < bestMs * 0.9f)
+		{
+			best = candidate;
+			bestMs = ms;
+		}
+	}
+
+	pipelineMs = bestMs;
+	if (best == PIPELINE_AUTO) ofLogError("ofxKinectV2::benchmarkPipelines") << "no depth decoder initialized";
+	else ofLogNotice("ofxKinectV2::benchmarkPipelines") << "using " << getPipelineName(best) << ", " << bestMs << " ms per depth packet";
+	return best;
+}
+
+//--------------------------------------------------------------------------------
+static std::string getHostName()
+{
+#ifdef TARGET_WIN32
+	const char* name = getenv("COMPUTERNAME");
+	std::string host = name ? name : "";
+#else
+	char name[256] = { 0 };
+	gethostname(name, sizeof(name) - 1);
+	std::string host = name;
+#endif
+	return host.empty() ? "unknown" : host;
+}
+
+//--------------------------------------------------------------------------------
+ofxKinectV2::Pipeline ofxKinectV2::readPipelineCache()
+{
+	if (pipelineCachePath.empty() || !ofFile::doesFileExist(pipelineCachePath))
+		return PIPELINE_AUTO;
+
+	const std::string host = getHostName();
+	ofBuffer buffer = ofBufferFromFile(pipelineCachePath);
+	for (auto line : buffer.getLines())
+	{
+		auto fields = ofSplitString(line, " ", true, true);
+		if (fields.size() != 3 || fields[0] != host) continue;
+		for (int i = PIPELINE_CPU; i < NUM_PIPELINES; i++)
+		{
+			if (fields[1] != getPipelineName((Pipeline)i)) continue;
+			pipelineMs = ofToFloat(fields[2]);
+			return (Pipeline)i;
+		}
+	}
+	return PIPELINE_AUTO;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2::writePipelineCache(Pipeline type, float ms)
+{
+	if (pipelineCachePath.empty())
+		return;
+
+	// replaces this host's line, the other hosts sharing the data folder stay
+	const std::string host = getHostName();
+	std::string text;
+	if (ofFile::doesFileExist(pipelineCachePath))
+	{
+		ofBuffer previous = ofBufferFromFile(pipelineCachePath);
+		for (auto line : previous.getLines())
+		{
+			auto fields = ofSplitString(line, " ", true, true);
+			if (fields.empty() || fields[0] == host) continue;
+			text += line + "\n";
+		}
+	}
+	text += host + " " + getPipelineName(type) + " " + ofToString(ms, 2) + "\n";
+	ofBufferToFile(pipelineCachePath, ofBuffer(text.c_str(), text.size()));
+}
+
+void ofxKinectV2::closeKinect()
+{
+	if (listener) listener->release(frames);
+
+	dev->stop();
+	dev->close();
+	runningStreams = 0;
+
+	// takes the pipeline with it and lets freenect2 open the serial again
+	delete dev;
+	dev = 0;
+	pipeline = 0;
 
 	delete listener;
 	listener = NULL;
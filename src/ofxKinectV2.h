@@ -13,6 +13,8 @@
 #include <libfreenect2/frame_listener_impl.h>
 
 #include "ofMain.h"
+#include "ofxKinectV2Kernels.h"
+#include "ofxKinectV2Registration.h"
 
 class ofxKinectV2 : public ofThread {
 
@@ -24,6 +26,121 @@ public:
 		int freenectId; //don't use this one - this is the index given by freenect2 - but this can change based on order device is plugged in
 	};
 
+	// zero copy frame set. the pixels are views into libfreenect2 frame memory and stay valid while the lease is held.
+	// color and aligned are BGRA, ir is in 0-65535
+	struct FrameLease {
+		ofPixels color;
+		ofFloatPixels ir;
+		ofFloatPixels rawDepth;
+		ofPixels aligned;
+		ofFloatPixels bigDepth;
+
+		std::shared_ptr<libfreenect2::Frame> colorFrame;
+		std::shared_ptr<libfreenect2::Frame> irFrame;
+		std::shared_ptr<libfreenect2::Frame> depthFrame;
+		std::shared_ptr<libfreenect2::Frame> undistortedFrame;
+		std::shared_ptr<libfreenect2::Frame> registeredFrame;
+		std::shared_ptr<libfreenect2::Frame> bigDepthFrame;
+	};
+
+	// device stamps of a frame set, zero for a stream that isn't running
+	struct FrameInfo {
+		uint32_t colorSequence = 0;
+		uint32_t colorTimestamp = 0;    // roughly 0.1 ms units
+		uint32_t depthSequence = 0;     // ir and depth share it
+		uint32_t depthTimestamp = 0;
+		uint64_t hostTime = 0;          // ofGetElapsedTimeMicros() when the set came out of the listener
+		uint64_t readyTime = 0;         // ofGetElapsedTimeMicros() once every product was computed
+	};
+
+	// sent from the worker thread as soon as a frame set is published. the products are those of that set and
+	// stay untouched until the handler returns, disabled ones are unallocated. don't call openGL from the handler
+	struct FrameEventArgs {
+		FrameInfo info;
+		const ofPixels* color;
+		const ofFloatPixels* ir;
+		const ofShortPixels* irShort;
+		const ofFloatPixels* rawDepth;
+		const ofPixels* depth;
+		const ofPixels* aligned;
+		const ofFloatPixels* bigDepth;
+		const ofPixels* userMask;                              // unallocated unless a background is subtracted
+		const std::vector<ofVec4f>* pointCloudVertices;      // empty while bPackedPointCloud is set
+		const std::vector<ofFloatColor>* pointCloudColors;
+		const std::vector<uint16_t>* pointCloudPackedVertices; // empty unless bPackedPointCloud is set
+		const std::vector<uint32_t>* pointCloudPackedColors;
+		const std::vector<uint32_t>* pointCloudIndices;        // empty unless bCpuTriangulation is set
+	};
+	ofEvent<FrameEventArgs> frameReadyEvent;
+
+	// timed steps of the worker stages and the render side, recorded while bStats is set
+	enum Stage {
+		STAGE_WAIT = 0,        // blocked in listener->waitForNewFrame
+		STAGE_REGISTER,        // color reduction, registration apply or undistortDepth
+		STAGE_COPY,            // color, ir, raw depth and aligned pixels
+		STAGE_COLORIZE,        // colorized depth
+		STAGE_POINT_CLOUD,
+		STAGE_TRIANGULATE,     // cpu mesh indices
+		STAGE_LATENCY,         // frame set out of the listener until published
+		STAGE_UPDATE_TEXTURE,
+		STAGE_GET_VBO,
+		STAGE_LOD,             // reduced point clouds and meshes
+		STAGE_TEMPORAL,        // temporal depth filter
+		STAGE_BACKGROUND,      // background learning and user mask
+		NUM_STAGES
+	};
+
+	// microseconds
+	struct StageStats {
+		uint64_t count = 0;
+		uint64_t p50 = 0;
+		uint64_t p95 = 0;
+		uint64_t p99 = 0;
+		uint64_t max = 0;
+	};
+
+	struct Stats {
+		StageStats stages[NUM_STAGES];
+		uint64_t framesProcessed = 0;   // published by the worker
+		uint64_t framesDropped = 0;     // gaps in the device sequence, never reached us
+		uint64_t framesOverwritten = 0; // published but replaced before the render side latched them
+	};
+
+	// products the worker computes, or them together for open() and setOutputs()
+	enum Output {
+		OUTPUT_COLOR = 1 << 0,              // color pixels
+		OUTPUT_IR = 1 << 1,                 // ir pixels, float or short
+		OUTPUT_RAW_DEPTH = 1 << 2,          // millimetre depth pixels
+		OUTPUT_DEPTH = 1 << 3,              // colorized depth, skipped anyway while bUseRawDepth is set
+		OUTPUT_ALIGNED = 1 << 4,            // color registered to depth
+		OUTPUT_POINT_CLOUD = 1 << 5,        // vertices and getVbo
+		OUTPUT_POINT_CLOUD_COLORS = 1 << 6, // registered colors for the point cloud
+		OUTPUT_ALL = (1 << 7) - 1,
+		OUTPUT_BIG_DEPTH = 1 << 7           // depth mapped onto the color image, opt in, not part of OUTPUT_ALL
+	};
+	static const int NUM_OUTPUTS = 8;
+
+	// point cloud and mesh resolution. the worker builds the reduced levels for every frame while they are asked
+	// for, and stops a second after the last request. a level asked for the first time shows up with the next frame
+	enum Lod {
+		LOD_FULL = 0, // 512x424, as computed by the worker
+		LOD_HALF,     // every 2nd pixel, 256x212
+		LOD_QUARTER,  // every 4th pixel, 128x106
+		LOD_ADAPTIVE, // near planar regions merged into larger triangles, only the points the mesh uses
+		NUM_LODS
+	};
+
+	// libfreenect2 depth decoder. PIPELINE_AUTO times every one this build of libfreenect2 has on a synthetic wall and
+	// disc before the device opens and keeps the fastest that initialized, see setPipelineCachePath()
+	enum Pipeline {
+		PIPELINE_AUTO = 0,
+		PIPELINE_CPU,
+		PIPELINE_OPENGL, // open() has to be called from the GL thread, its context is shared with the decoder
+		PIPELINE_OPENCL,
+		PIPELINE_CPU_SIMD, // ofxKinectV2DepthProcessor, where OFXKINECTV2_DEPTH_PROCESSOR builds it
+		NUM_PIPELINES
+	};
+
 	ofxKinectV2();
 	~ofxKinectV2();
 
@@ -31,71 +148,421 @@ public:
 	vector<KinectDeviceInfo> getDeviceList();
 	unsigned int getNumDevices();
 
-	bool open(string serial);
-	bool open(unsigned int deviceId = 0);
-	bool isFrameNew() { return bNewFrame; }
+	bool open(string serial, unsigned int outputs = OUTPUT_ALL, Pipeline pipeline = PIPELINE_OPENCL);
+	bool open(unsigned int deviceId = 0, unsigned int outputs = OUTPUT_ALL, Pipeline pipeline = PIPELINE_OPENCL);
+
+	// pipeline the device runs on since open(), and the ms per depth packet it took in the auto benchmark (0 without one)
+	Pipeline getPipeline() const { return pipelineType; }
+	float getPipelineMs() const { return pipelineMs; }
+	static const char* getPipelineName(Pipeline pipeline);
+	// text file in the data folder keeping the auto choice, one "host pipeline ms" line per machine, only read and
+	// written by a PIPELINE_AUTO open(). remove a line or the file to benchmark again, empty benchmarks every time
+	void setPipelineCachePath(const std::string& path) { pipelineCachePath = path; }
+	const std::string& getPipelineCachePath() const { return pipelineCachePath; }
+	// threads PIPELINE_CPU_SIMD splits each depth packet across, 0 uses all hardware threads. takes effect on the
+	// next open()
+	void setDepthThreads(int numThreads) { depthThreads = numThreads; }
+	int getDepthThreads() const { return depthThreads; }
+	// write the device tables and the next numPackets raw depth packets to path in the data folder, for the thread
+	// scaling section of bench/. PIPELINE_CPU_SIMD only, false on the other pipelines or before open()
+	bool recordDepthPackets(const std::string& path, int numPackets);
+	// keep the registration tables in ofxKinectV2_<serial>.tables in the data folder, rebuilt when the firmware or
+	// camera parameters change or the file is damaged. off by default, takes effect on the next open()
+	void setTableCache(bool enabled) { bTableCache = enabled; }
+	bool isTableCache() const { return bTableCache; }
+
+	// change the products at runtime, the color and depth streams are started or stopped to match
+	void setOutputs(unsigned int outputs);
+	unsigned int getOutputs() const { return outputMask; }
+	// true while the front frame hasn't been uploaded by updateTexture or a newer one is waiting
+	bool isFrameNew();
+	// stamps of the front frame set
+	const FrameInfo& getFrameInfo() const;
+
+	// latch the newest complete frame set and keep it until releaseFrame(), e.g. across update() and draw().
+	// returns true if it is a new one. without a held frame updateTexture and getVbo latch the newest themselves
+	bool acquireFrame();
+	void releaseFrame();
+
 	void updateTexture(ofTexture* color, ofTexture* ir = nullptr, ofTexture* depth = nullptr, ofTexture* aligned = nullptr);
-	std::vector<ofVec4f>& getPointCloudVertices();
-	std::vector<ofFloatColor>& getPointCloudColors();
-	// return number of indices
-	int getVbo(ofVbo& vbo);
+
+	// hand frames to consumers without copying them, takes effect on the next open()
+	void setZeroCopy(bool zeroCopy) { bZeroCopy = zeroCopy; }
+	bool isZeroCopy() const { return bZeroCopy; }
+	// let the worker write color, ir, depth and aligned straight into persistently mapped pixel buffers so
+	// updateTexture only issues the texture copies from them. needs GL 4.4 or ARB_buffer_storage, not used
+	// with zero copy. takes effect on the next open(), which then has to be called from the GL thread
+	void setAsyncUpload(bool asyncUpload) { bAsyncUpload = asyncUpload; }
+	bool isAsyncUpload() const { return bAsyncUpload; }
+	// front frame set in zero copy mode, nullptr otherwise. hold on to it for as long as the pixels are needed
+	std::shared_ptr<FrameLease> getFrameLease();
+	// only filled while bUseShortIr is set, 0-65535
+	ofShortPixels& getIrShortPixels();
+	// only filled while OUTPUT_BIG_DEPTH is set. 1920x1082 mm of the nearest depth pixel around each color pixel,
+	// infinity where there is none. color row y is row y + 1, the first and last rows are padding
+	ofFloatPixels& getBigDepthPixels();
+	// only filled while bSubtractBackground is set and the background is learned. 512x424, 255 where the undistorted
+	// depth is in front of the background and 0 elsewhere, the point cloud and meshes leave the 0 pixels out and
+	// updateMesh() only uploads the rows with users in them. computed whatever the outputs
+	ofPixels& getUserMaskPixels();
+	// forget the background and learn it again from the next backgroundFrames frames, the scene should be empty meanwhile
+	void learnBackground();
+	bool isBackgroundLearned() const { return bBackgroundLearned; }
+	// float layout, unpacked on first call per frame while bPackedPointCloud is set
+	std::vector<ofVec4f>& getPointCloudVertices(Lod lod = LOD_FULL);
+	std::vector<ofFloatColor>& getPointCloudColors(Lod lod = LOD_FULL);
+	// half float xyzw and RGBA8 per point, only filled while bPackedPointCloud is set
+	std::vector<uint16_t>& getPointCloudPackedVertices();
+	std::vector<uint32_t>& getPointCloudPackedColors();
+	// mesh indices for the point cloud of the same lod, 3 per triangle with no padding.
+	// LOD_FULL is only filled while bCpuTriangulation is set, the other levels are always triangulated on the cpu
+	std::vector<uint32_t>& getPointCloudIndices(Lod lod = LOD_FULL);
+	// return number of indices, all of them real triangles. on the compute shader path this maps the draw command
+	// and waits for the gpu. the cpu paths know the count, it is getPointCloudIndices(lod).size()
+	OF_DEPRECATED_MSG("use updateMesh() and drawMesh()", int getVbo(ofVbo& vbo, Lod lod = LOD_FULL));
+	// same as getVbo without reading the index count back, false if there was no point cloud
+	bool updateMesh(ofVbo& vbo, Lod lod = LOD_FULL);
+	// draws the triangles of the last updateMesh() with glDrawElementsIndirect, the count stays on the gpu.
+	// needs the programmable renderer, binds its shader the way vbo.drawElements() would
+	void drawMesh(const ofVbo& vbo);
 	void close();
 
+	static const char* getStageName(Stage stage);
+	Stats getStats() const;
+	void resetStats();
+
 	ofParameterGroup params;
 	ofParameter<float> minDistance;
 	ofParameter<float> maxDistance;
 	ofParameter<bool> bUseRawDepth;
+	ofParameter<bool> bUseShortIr; // deliver ir as 16 bit instead of normalized float
+	// frame sets allowed to wait in front of each pipeline stage. more smooths out stalls for throughput, 1 keeps latency lowest
+	ofParameter<int> queueDepth;
+	ofParameter<bool> bStats; // collect timings and frame counters
+	// 12 instead of 32 bytes a point for the point cloud and getVbo, half float xyzw in metres and RGBA8 color.
+	// ofVbo can only describe float attributes, so a packed vbo has to be drawn with drawMesh()
+	ofParameter<bool> bPackedPointCloud;
+	// build the mesh indices on the worker instead of with the compute shader in getVbo, also works without GL 4.3
+	ofParameter<bool> bCpuTriangulation;
+	// how far in mm LOD_ADAPTIVE lets depth stray from a merged triangle
+	ofParameter<float> lodTolerance;
+	// color frames halved this many times (0-3) right after decoding, the color output, aligned colors, point cloud
+	// colors and bigdepth then all come from the small image. the jpeg decode costs the same: libfreenect2 still
+	// decodes the full 1920x1080 frame and it is box filtered after that, what gets cheaper is everything downstream
+	ofParameter<int> colorReduction;
+	// depth decoder settings, a change restarts the streams. fastDepth skips both filters whatever their toggles say,
+	// clipDepth has the decoder drop depth outside minDistance - maxDistance instead of its default 500 - 4500 mm.
+	// with clipDepth on a distance change restarts them once it has rested for 300 ms
+	ofParameter<bool> bFastDepth;
+	ofParameter<bool> bBilateralFilter; // removes some flying pixels
+	ofParameter<bool> bEdgeAwareFilter; // removes the noisy pixels along depth edges
+	ofParameter<bool> bClipDepth;
+	// temporal depth filter, applied to the depth frame before anything is made from it. temporalMedian is the
+	// number of frames in a per pixel median, 1 is off and even counts use one less. temporalSmoothing (0 is off) is
+	// how much of the previous result each pixel keeps, changes above temporalThreshold mm are taken as they are
+	ofParameter<int> temporalMedian;
+	ofParameter<float> temporalSmoothing;
+	ofParameter<float> temporalThreshold;
+	// background subtraction, turning it on learns the background from the mean of the next backgroundFrames
+	// frames. pixels closer than backgroundTolerance mm to it are left out
+	ofParameter<bool> bSubtractBackground;
+	ofParameter<int> backgroundFrames;
+	ofParameter<float> backgroundTolerance;
+	// labels with the current stats, refreshed twice a second while bStats is set. not part of params, add it to a gui to show it
+	ofParameterGroup statsParams;
+	ofParameterGroup outputParams; // one toggle per Output bit
+	ofParameter<bool> bOutputs[NUM_OUTPUTS];
 	
 protected:
+	// one frame set travelling acquire -> register -> derive
+	struct FrameJob {
+		FrameInfo info;
+		std::shared_ptr<libfreenect2::Frame> color;
+		std::shared_ptr<libfreenect2::Frame> ir;
+		std::shared_ptr<libfreenect2::Frame> depth;
+		std::shared_ptr<libfreenect2::Frame> undistorted;
+		std::shared_ptr<libfreenect2::Frame> registered;
+		std::shared_ptr<libfreenect2::Frame> bigDepth;
+
+		// products to make from it
+		bool bColor = false;
+		bool bIr = false;
+		bool bRawDepth = false;
+		bool bDepth = false;
+		bool bAligned = false;
+		bool bPointCloud = false;
+		bool bPointCloudColors = false;
+		bool bBigDepth = false;
+	};
+
 	void threadedFunction();
-	int openKinect(std::string serial);
+	void registerStage();
+	void deriveStage();
+	void deriveOutputs(FrameJob& job);
+	void onQueueDepthChanged(int&);
+	void onStatsChanged(bool&);
+	void onUpdate(ofEventArgs&);
+
+	// 0 while stats are off, pass it on to endStage
+	uint64_t beginStage() const;
+	void endStage(Stage stage, uint64_t begin);
+	void countSequence(const libfreenect2::Frame* frame, int64_t& last);
+
+	std::atomic<bool> bStatsEnabled{ false };
+	ofxKinectV2Kernels::LatencyHistogram stageHistograms[NUM_STAGES];
+	std::atomic<uint64_t> framesProcessed{ 0 };
+	std::atomic<uint64_t> framesDropped{ 0 };
+	std::atomic<uint64_t> framesOverwritten{ 0 };
+	// last device sequence per stream, -1 after a (re)start. acquire stage only
+	int64_t lastColorSequence = -1;
+	int64_t lastDepthSequence = -1;
+	ofParameter<std::string> statsLabels[NUM_STAGES];
+	ofParameter<std::string> statsCounters;
+	uint64_t lastStatsRefresh = 0;
+	void copyBGRX(const libfreenect2::Frame* src, ofPixels& dst);
+	void copyIr(const libfreenect2::Frame* src, int index);
+	void onDistanceChanged(float&);
+	void onOutputChanged(bool&);
+	void onDepthConfigChanged(bool&);
+	void onSubtractBackgroundChanged(bool&);
+	libfreenect2::Freenect2Device::Config getDepthConfig() const;
+	void startStreams(unsigned int outputs);
+	void updateDepthLut();
+	int openKinect(std::string serial, Pipeline type);
 	void closeKinect();
+	libfreenect2::PacketPipeline* createPipeline(Pipeline type);
+	Pipeline benchmarkPipelines();
+	Pipeline readPipelineCache();
+	void writePipelineCache(Pipeline type, float ms);
 	
 	bool bOpened = false;
+	bool bZeroCopy = false;
+	bool bAsyncUpload = false;
+
+	// one persistently mapped pixel unpack buffer per product and slot
+	struct UploadBuffer {
+		ofBufferObject buffer;
+		void* mapped = nullptr;
+		size_t size = 0;
+	};
+	void allocateUploadBuffers(unsigned int outputs);
+	void freeUploadBuffers();
+	void allocateUploadBuffer(UploadBuffer& upload, size_t size);
+	template<class T> void bindUploadView(ofPixels_<T>& pixels, const UploadBuffer& upload, size_t width, size_t height, size_t channels);
+	template<class T> bool loadFromUploadBuffer(ofTexture& texture, const ofPixels_<T>& pixels, const UploadBuffer& upload, int glInternalFormat, int glFormat, int glType);
+	void waitUploadFence(int index);
+	std::vector<UploadBuffer> uploadColor;
+	std::vector<UploadBuffer> uploadIr;
+	std::vector<UploadBuffer> uploadDepth;
+	std::vector<UploadBuffer> uploadAligned;
+	// set after a slot's uploads were issued, the slot only goes back to the worker once the gpu passed it
+	std::vector<GLsync> uploadFences;
 
+	// mirrors bOutputs for the worker
+	std::atomic<unsigned int> outputMask{ OUTPUT_ALL };
+	// STREAM_COLOR | STREAM_DEPTH currently running on the device, only touched by open and the worker
+	enum Stream {
+		STREAM_COLOR = 1 << 0,
+		STREAM_DEPTH = 1 << 1
+	};
+	static unsigned int getStreams(unsigned int outputs);
+	unsigned int runningStreams = 0;
+
+	void publishFrame();
+	void notifyFrameReady(int index);
+	bool latchFrame();
+
+	// triple buffer: the worker owns indexBack, the render thread owns indexFront and the third
+	// buffer is parked in the mailbox together with a flag telling if it holds an unread frame
+	static const int NUM_BUFFERS = 3;
+	static const int MAILBOX_INDEX = 0x3;
+	static const int MAILBOX_FRESH = 0x4;
 	int indexFront = 0;
 	int indexBack = 1;
-	bool bNewFrame = false;
+	std::atomic<int> mailbox{ 2 };
+	bool bFrameHeld = false;
+	bool bFrontUploaded = true;
 	
 	std::vector<ofPixels> frameColor;
 	std::vector<ofPixels> frameDepth;
 	std::vector<ofFloatPixels> frameIr;
+	std::vector<ofShortPixels> frameIrShort;
 	std::vector<ofFloatPixels> frameRawDepth;
 	std::vector<ofPixels> frameAligned;
+	std::vector<ofPixels> frameUserMask;
+	// rows [begin, end) of each slot's point cloud that can hold foreground points, all rows without a mask
+	std::vector<std::pair<int, int> > frameUserRows;
+	std::vector<ofFloatPixels> frameBigDepth;
+	std::vector<std::shared_ptr<FrameLease> > frameLeases;
+	std::vector<FrameInfo> frameInfos;
+
+	// recycles the undistorted/registered, reduced color and bigdepth frames that leases keep alive
+	struct FramePool {
+		FramePool(size_t width, size_t height) : width(width), height(height) {}
+		size_t width;
+		size_t height;
+		std::mutex mutex;
+		std::vector<libfreenect2::Frame*> frames;
+		~FramePool() { for (auto frame : frames) delete frame; }
+	};
+	std::shared_ptr<FramePool> framePool;
+	std::shared_ptr<FramePool> bigDepthPool;
+	std::shared_ptr<FramePool> colorPool;
+	std::shared_ptr<libfreenect2::Frame> acquirePooledFrame(const std::shared_ptr<FramePool>& source);
+	void reduceColor(FrameJob& job, int scale);
+	void filterDepthTemporal(libfreenect2::Frame* depth);
+
+	// temporal filter state, only touched by the register stage. the last frames of the median as one plane
+	// each in a ring, and the smoothed depth
+	static const int MAX_MEDIAN_FRAMES = 5;
+	std::vector<float> temporalHistory;
+	std::vector<float> temporalState;
+	int temporalHead = 0;
+	int temporalMedianFrames = 0; // frames in the ring, 0 until the first one filled it
+
+	// background model, only touched by the derive stage. false until backgroundFrames frames were accumulated
+	bool updateUserMask(const float* depth, ofPixels& mask, std::pair<int, int>& rows);
+	std::vector<float> backgroundSum;
+	std::vector<float> backgroundCount;
+	std::vector<float> background;
+	int backgroundLearnedFrames = 0;
+	std::atomic<bool> bBackgroundReset{ true };
+	std::atomic<bool> bBackgroundLearned{ false };
 
 	std::vector<std::vector<ofVec4f> > pcVertices;
 	std::vector<std::vector<ofFloatColor> > pcColors;
+	std::vector<std::vector<uint16_t> > pcPackedVertices;
+	std::vector<std::vector<uint32_t> > pcPackedColors;
+	std::vector<std::vector<uint32_t> > pcIndices;
+	// undistorted depth for the compute shader, only kept while it triangulates
+	std::vector<ofFloatPixels> frameUndistorted;
+
+	// per band output of a parallel triangulation, packed back to back once all bands are done
+	struct TriangulateScratch {
+		std::vector<std::vector<uint32_t> > bands;
+		std::vector<size_t> counts;
+	};
+	void triangulate(const float* depth, const uint8_t* user, std::vector<uint32_t>& indices);
+	void triangulateRows(size_t numRows, size_t maxRowIndices, const std::function<size_t(size_t, size_t, uint32_t*)>& rows,
+		TriangulateScratch& scratch, std::vector<uint32_t>& indices);
+	void setupMesh();
+	bool bMeshSetup = false;
+	TriangulateScratch triangulateScratch;
+
+	// render side float copy of a packed front cloud
+	void unpackPointCloud();
+	std::vector<ofVec4f> pcUnpackedVertices;
+	std::vector<ofFloatColor> pcUnpackedColors;
+	bool bFrontUnpacked = false;
+
+	// reduced levels, built by the derive stage into each slot, NUM_LODS per slot with the LOD_FULL one unused
+	struct LodMesh {
+		std::vector<ofVec4f> vertices;
+		std::vector<ofFloatColor> colors;
+		std::vector<ofVec2f> texCoords;
+		std::vector<uint32_t> indices;
+	};
+	LodMesh& getLodMesh(Lod lod);
+	void buildLods(bool bPointCloud);
+	void buildLod(Lod lod, const std::vector<ofVec4f>& vertices, const std::vector<ofFloatColor>& colors, LodMesh& mesh);
+	bool updateLodMesh(ofVbo& vbo, Lod lod);
+	std::vector<LodMesh> lodMeshes;
+	// ofGetElapsedTimeMillis() of the last request per level, 0 for never
+	std::atomic<uint64_t> lodRequestTime[NUM_LODS];
+	// derive stage scratch
+	std::vector<ofVec4f> lodVertices;
+	std::vector<ofFloatColor> lodColors;
+	std::vector<float> lodDepth;
+	std::vector<float> lodGridDepth;
+	std::vector<uint32_t> lodRemap;
+	TriangulateScratch lodScratch;
+
+	// packed point cloud attributes for getVbo, with the vao drawMesh() draws them from
+	void uploadPackedPointCloud(ofVbo& vbo, const std::vector<uint16_t>& vertices, const std::vector<uint32_t>& colors);
+	ofBufferObject packedVertexBuffer;
+	ofBufferObject packedColorBuffer;
+	// background points are NaN, so a full level vertex buffer only takes the rows that hold foreground in this frame
+	// or did in its last upload. a buffer uploaded elsewhere in between gets every row
+	std::pair<int, int> getUploadRows(GLuint vertexBuffer);
+	GLuint uploadedVertexBuffer = 0;
+	std::pair<int, int> uploadedRows;
+	GLuint packedVao = 0;
+
+	// packed RGBX per millimetre for the colorized depth, rebuilt when min/maxDistance change
+	std::vector<uint32_t> depthLut;
+	std::atomic<bool> bDepthLutDirty{ true };
+	// set when the depth decoder settings changed, the worker stops the device to apply them from depthConfigDue
+	// (elapsed micros) on
+	std::atomic<bool> bDepthConfigDirty{ false };
+	std::atomic<uint64_t> depthConfigDue{ 0 };
+
+	// (i + 0.5 - c) / f per column and row, built from the ir intrinsics on open
+	std::vector<float> rayX;
+	std::vector<float> rayY;
+
+	std::unique_ptr<ofxKinectV2Kernels::ThreadPool> pool;
+
+	ofxKinectV2Kernels::BoundedQueue<std::unique_ptr<FrameJob> > acquiredQueue;
+	ofxKinectV2Kernels::BoundedQueue<std::unique_ptr<FrameJob> > registeredQueue;
+	std::thread registerThread;
+	std::thread deriveThread;
 
 private:
 	libfreenect2::Freenect2 freenect2;
 
 	libfreenect2::Freenect2Device *dev = 0;
+	// owned by dev once opened
 	libfreenect2::PacketPipeline *pipeline = 0;
+	Pipeline pipelineType = PIPELINE_AUTO;
+	float pipelineMs = 0;
+	std::string pipelineCachePath = "ofxKinectV2Pipelines.txt";
+	int depthThreads = 0;
+	bool bTableCache = false;
 
 	libfreenect2::FrameMap frames;
 
-	libfreenect2::Registration* registration;
-	libfreenect2::SyncMultiFrameListener* listener;
+	ofxKinectV2Registration* registration = 0;
+	libfreenect2::SyncMultiFrameListener* listener = 0;
 
 	const int DEPTH_WIDTH = 512;
 	const int DEPTH_HEIGHT = 424;
+	// longest mesh edge in mm, MAX_NEAR in comp_glsl
+	const float MESH_MAX_NEAR = 100.0f;
+	// largest LOD_ADAPTIVE block in cells
+	const int LOD_MAX_BLOCK = 16;
+	const int COLOR_WIDTH = 1920;
+	const int COLOR_HEIGHT = 1080;
 
 	ofTexture depthTexture;
+	ofTexture userTexture;
 	ofShader computeIndices;
-	ofBufferObject indicesBuffer;
-	ofBufferObject atomicCounter;
+	// index buffer and draw command per level, so vbos of different levels can be drawn in one frame
+	struct MeshBuffers {
+		ofBufferObject indices;
+		ofBufferObject drawCommand;
+		// indices in the last mesh, -1 while only the compute shader knows
+		int indexCount = 0;
+	};
+	MeshBuffers meshBuffers[NUM_LODS];
 
 	const char* comp_glsl = R"(
 #version 430 core
 
 layout(r32f, binding = 0) uniform readonly image2D src;
-layout(r32f, binding = 1) uniform readonly image2D user;
+layout(r8, binding = 1) uniform readonly image2D user;
 
 layout(std430, binding = 0) buffer indices_buffer {
     int indices[];
 };
 
-layout(binding = 0) uniform atomic_uint mAtomicCounter;
+// DrawElementsIndirectCommand, count is bumped by 3 per triangle so glDrawElementsIndirect draws what got written
+layout(std430, binding = 1) buffer draw_command {
+    uint count;
+    uint instance_count;
+    uint first_index;
+    int base_vertex;
+    uint base_instance;
+};
 
 uniform int bUseUserMap = 0;
 
@@ -156,59 +623,44 @@ void main()
 	bool has_right_edge = MAX_NEAR > abs(depth_top - depth);
 	bool has_bottom_edge = MAX_NEAR > abs(depth_left - depth);
 	
-	int num_triangles = 0;
+	// only real triangles are written, count ends up holding their indices
+	bool has_triangles = false;
 
-			// check top-right and left-bottom triangles
+	// check top-right and left-bottom triangles
 	if (depth_top_left != 0.0 && depth != 0.0)
 	{
 		if (has_top_edge && has_right_edge && depth_top != 0.0)
 		{
-			uint i = atomicCounterIncrement(mAtomicCounter) * 3;
+			uint i = atomicAdd(count, 3u);
 			push_index(i, index, index_top, index_top_left);
-			num_triangles++;
+			has_triangles = true;
 		}
 		
 		if (has_left_edge && has_bottom_edge && depth_left != 0.0)
 		{
-			uint i = atomicCounterIncrement(mAtomicCounter) * 3;
+			uint i = atomicAdd(count, 3u);
 			push_index(i, index, index_top_left, index_left);
-			num_triangles++;
+			has_triangles = true;
 		}
 	}
 	
 	// skip if we have enough triangles
-	if (num_triangles > 0) 
-	{	
-		while (num_triangles < 2)
-		{
-			uint i = atomicCounterIncrement(mAtomicCounter) * 3;
-			push_index(i, 0, 0, 0);
-			num_triangles++;
-		}
-		return;
-	}
+	if (has_triangles) return;
 	
 	// check top-left and right-bottom triangles
 	if (depth_top != 0.0 && depth_left != 0.0)
 	{
 		if (has_top_edge && has_left_edge && depth_top_left != 0.0)
 		{
-			uint i = atomicCounterIncrement(mAtomicCounter) * 3;
+			uint i = atomicAdd(count, 3u);
 			push_index(i, index_top, index_top_left, index_left);
 		}
 		
 		if (has_right_edge && has_bottom_edge && depth != 0.0)
 		{
-			uint i = atomicCounterIncrement(mAtomicCounter) * 3;
+			uint i = atomicAdd(count, 3u);
 			push_index(i, index_left, index, index_top);
 		}
-	}
-
-			while (num_triangles < 2)
-	{
-		uint i = atomicCounterIncrement(mAtomicCounter) * 3;
-		push_index(i, 0, 0, 0);
-		num_triangles++;
 	}
 }
 
@@ -0,0 +1,1173 @@
+//
+//  ofxKinectV2DepthProcessor.cpp
+//  kinectExample
+//
+
+#include "ofxKinectV2DepthProcessor.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#if OFXKINECTV2_DEPTH_PROCESSOR
+#include <libfreenect2/async_packet_processor.h>
+#include <libfreenect2/depth_packet_stream_parser.h>
+#include <libfreenect2/rgb_packet_stream_parser.h>
+#include <libfreenect2/protocol/response.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define KV2_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define KV2_TARGET(x)
+#else
+#define KV2_TARGET(x) __attribute__((target(x)))
+#endif
+#endif
+
+using namespace ofxKinectV2Kernels;
+
+static const int WIDTH = ofxKinectV2DepthDecoder::WIDTH;
+static const int HEIGHT = ofxKinectV2DepthDecoder::HEIGHT;
+static const size_t NUM_PIXELS = WIDTH * HEIGHT;
+static const double PI = 3.14159265358979323846;
+static const char RECORDING_MAGIC[8] = { 'K', 'V', '2', 'D', 'E', 'P', 'T', 'H' };
+
+// libfreenect2::DepthPacketProcessor::Parameters, the device never changes them
+static const float abMultiplier = 0.6666667f;
+static const float abMultiplierPerFrq[3] = { 1.322581f, 1.0f, 1.612903f };
+static const float abOutputMultiplier = 16.0f;
+static const float phaseInRad[3] = { 0.0f, 2.094395f, 4.18879f };
+static const float jointBilateralAbThreshold = 3.0f;
+static const float jointBilateralMaxEdge = 2.5f;
+static const float jointBilateralExp = 5.0f;
+static const float gaussianKernel[9] = {
+	0.1069973f, 0.1131098f, 0.1069973f,
+	0.1131098f, 0.1195716f, 0.1131098f,
+	0.1069973f, 0.1131098f, 0.1069973f };
+static const float phaseOffset = 0.0f;
+static const float unambiguousDist = 2083.333f;
+static const float individualAbThreshold = 3.0f;
+static const float abThreshold = 10.0f;
+static const float abConfidenceSlope = -0.5330578f;
+static const float abConfidenceOffset = 0.7694894f;
+static const float minDealiasConfidence = 0.3490659f;
+static const float maxDealiasConfidence = 0.6108653f;
+static const float edgeAbAvgMinValue = 50.0f;
+static const float edgeAbStdDevThreshold = 0.05f;
+static const float edgeCloseDeltaThreshold = 50.0f;
+static const float edgeFarDeltaThreshold = 30.0f;
+static const float edgeMaxDeltaThreshold = 100.0f;
+static const float edgeAvgDeltaThreshold = 0.0f;
+static const float maxEdgeCount = 5.0f;
+
+// plane layout of the stage buffers
+static const int PLANE_AMPLITUDE = 6; // measured: a0 b0 a1 b1 a2 b2 amp0 amp1 amp2
+static const int PLANE_EDGE_TEST = 6; // filtered: a0 b0 a1 b1 a2 b2 edge test (1 or 0)
+static const int PLANE_DEPTH = 0;     // unwrapped: depth ir sum
+static const int PLANE_IR_SUM = 1;
+static const int NUM_MEASURED_PLANES = 9;
+static const int NUM_FILTERED_PLANES = 7;
+static const int NUM_UNWRAPPED_PLANES = 2;
+
+// planes of rows [firstRow, firstRow + numRows) of the frame, in table row order (flipped to the output)
+struct DepthPlanes {
+	float* data;
+	int firstRow;
+	int numRows;
+
+	float* row(int plane, int y) const { return data + ((size_t)plane * numRows + (y - firstRow)) * WIDTH; }
+};
+
+//--------------------------------------------------------------------------------
+// scalar reference, the per pixel functions of CpuDepthPacketProcessor. the borders of the simd paths use them too
+//--------------------------------------------------------------------------------
+static inline int32_t unpackMeasurement(const unsigned char* packet, const int32_t* lut, int sub, int x, int y) {
+	if (x < 1 || x > 510) return lut[0];
+
+	// 11 bit values, the 4 quarters of a row are interleaved and the two halves of the frame are stored flipped
+	const int bit = ((x >> 2) + ((x & 3) << 7)) * 11;
+	const int row = y < 212 ? y + 212 : 423 - y;
+	const unsigned char* p = packet + ofxKinectV2DepthDecoder::SUB_IMAGE_SIZE * sub + row * 704 + (bit >> 4) * 2;
+	const uint32_t word = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	return lut[(word >> (bit & 15)) & 2047];
+}
+
+static void measurePixel(const unsigned char* packet, const int32_t* lut, const float* trig, const float* zTable,
+	int x, int y, const DepthPlanes& measured) {
+	const size_t i = (size_t)y * WIDTH + x;
+	const bool bValid = 0.0f < zTable[i];
+	for (int f = 0; f < 3; f++) {
+		int32_t m[3];
+		for (int k = 0; k < 3; k++) m[k] = unpackMeasurement(packet, lut, f * 3 + k, x, y);
+
+		const float* t = trig + f * 6 * NUM_PIXELS + i;
+		float a = 0.0f;
+		float b = 0.0f;
+		float amplitude = 0.0f;
+		if (bValid && (m[0] == 32767 || m[1] == 32767 || m[2] == 32767)) {
+			amplitude = 65535.0f; // saturated
+		} else if (bValid) {
+			a = t[0] * m[0] + t[NUM_PIXELS] * m[1] + t[2 * NUM_PIXELS] * m[2];
+			b = t[3 * NUM_PIXELS] * m[0] + t[4 * NUM_PIXELS] * m[1] + t[5 * NUM_PIXELS] * m[2];
+			a *= abMultiplierPerFrq[f];
+			b *= abMultiplierPerFrq[f];
+			amplitude = std::sqrt(a * a + b * b) * abMultiplier;
+		}
+		measured.row(f * 2, y)[x] = a;
+		measured.row(f * 2 + 1, y)[x] = b;
+		measured.row(PLANE_AMPLITUDE + f, y)[x] = amplitude;
+	}
+}
+
+static void bilateralPixel(const DepthPlanes& measured, int x, int y, const DepthPlanes& filtered) {
+	if (x < 1 || y < 1 || x > 510 || y > 422) {
+		for (int p = 0; p < 6; p++) filtered.row(p, y)[x] = measured.row(p, y)[x];
+		filtered.row(PLANE_EDGE_TEST, y)[x] = 1.0f;
+		return;
+	}
+
+	bool bEdgeTest = true;
+	for (int f = 0; f < 3; f++) {
+		const float a = measured.row(f * 2, y)[x];
+		const float b = measured.row(f * 2 + 1, y)[x];
+		const float norm2 = a * a + b * b;
+		float invNorm = 1.0f / std::sqrt(norm2);
+		invNorm = invNorm == invNorm ? invNorm : std::numeric_limits<float>::infinity();
+		const float normalizedA = a * invNorm;
+		const float normalizedB = b * invNorm;
+
+		float threshold = (jointBilateralAbThreshold * jointBilateralAbThreshold) / (abMultiplier * abMultiplier);
+		float exponent = jointBilateralExp;
+		if (norm2 < threshold) {
+			threshold = 0.0f;
+			exponent = 0.0f;
+		}
+
+		float weightSum = 0.0f;
+		float sumA = 0.0f;
+		float sumB = 0.0f;
+		float distSum = 0.0f;
+		for (int j = 0; j < 9; j++) {
+			if (j == 4) {
+				weightSum += gaussianKernel[j];
+				sumA += gaussianKernel[j] * a;
+				sumB += gaussianKernel[j] * b;
+				continue;
+			}
+			const int ox = x + j % 3 - 1;
+			const int oy = y + j / 3 - 1;
+			const float otherA = measured.row(f * 2, oy)[ox];
+			const float otherB = measured.row(f * 2 + 1, oy)[ox];
+			const float otherNorm2 = otherA * otherA + otherB * otherB;
+			// zero vectors normalize to nan like in libfreenect2, which drops the pixel and fails the edge test
+			float otherInvNorm = 1.0f / std::sqrt(otherNorm2);
+			otherInvNorm = otherInvNorm == otherInvNorm ? otherInvNorm : std::numeric_limits<float>::infinity();
+
+			float dist = -(otherA * otherInvNorm * normalizedA + otherB * otherInvNorm * normalizedB);
+			dist += 1.0f;
+			dist *= 0.5f;
+
+			float weight = 0.0f;
+			if (otherNorm2 >= threshold) {
+				weight = gaussianKernel[j] * std::exp(-1.442695f * exponent * dist);
+				distSum += dist;
+			}
+			sumA += weight * otherA;
+			sumB += weight * otherB;
+			weightSum += weight;
+		}
+
+		bEdgeTest = bEdgeTest && distSum < jointBilateralMaxEdge;
+		filtered.row(f * 2, y)[x] = 0.0f < weightSum ? sumA / weightSum : 0.0f;
+		filtered.row(f * 2 + 1, y)[x] = 0.0f < weightSum ? sumB / weightSum : 0.0f;
+	}
+	filtered.row(PLANE_EDGE_TEST, y)[x] = bEdgeTest ? 1.0f : 0.0f;
+}
+
+static void unwrapPixel(const DepthPlanes& ab, const DepthPlanes& measured, const float* xTable, const float* zTable,
+	int x, int y, const DepthPlanes& unwrapped, float* ir) {
+	float phases[3];
+	float amplitudes[3];
+	for (int f = 0; f < 3; f++) {
+		const float a = ab.row(f * 2, y)[x];
+		const float b = ab.row(f * 2 + 1, y)[x];
+		float phase = std::atan2(b, a);
+		phase = phase < 0 ? phase + PI * 2.0f : phase;
+		phases[f] = phase != phase ? 0 : phase;
+		amplitudes[f] = std::sqrt(a * a + b * b) * abMultiplier;
+	}
+
+	const float irSum = amplitudes[0] + amplitudes[1] + amplitudes[2];
+	const float irMin = std::min(std::min(amplitudes[0], amplitudes[1]), amplitudes[2]);
+	const float irMax = std::max(std::max(amplitudes[0], amplitudes[1]), amplitudes[2]);
+
+	float phase = 0.0f;
+	if (!(irMin < individualAbThreshold || irSum < abThreshold)) {
+		// the three wrapped phases to one phase over the combined unambiguous range
+		float t0 = phases[0] / (2.0f * PI) * 3.0f;
+		float t1 = phases[1] / (2.0f * PI) * 15.0f;
+		float t2 = phases[2] / (2.0f * PI) * 2.0f;
+
+		float t5 = std::floor((t1 - t0) * 0.333333f + 0.5f) * 3.0f + t0;
+		float t3 = -t2 + t5;
+		float t4 = t3 * 2.0f;
+
+		bool c1 = t4 >= -t4;
+		float f1 = c1 ? 2.0f : -2.0f;
+		float f2 = c1 ? 0.5f : -0.5f;
+		t3 *= f2;
+		t3 = (t3 - std::floor(t3)) * f1;
+
+		bool c2 = 0.5f < std::abs(t3) && std::abs(t3) < 1.5f;
+		float t6 = c2 ? t5 + 15.0f : t5;
+		float t7 = c2 ? t1 + 15.0f : t1;
+		float t8 = (std::floor((-t2 + t6) * 0.5f + 0.5f) * 2.0f + t2) * 0.5f;
+
+		t6 *= 0.333333f;
+		t7 *= 0.066667f;
+
+		float t9 = t8 + t6 + t7;
+		float t10 = t9 * 0.333333f;
+
+		t6 *= 2.0f * PI;
+		t7 *= 2.0f * PI;
+		t8 *= 2.0f * PI;
+
+		// distance of the three phases from the unwrapped one
+		float t8New = t7 * 0.826977f - t8 * 0.110264f;
+		float t6New = t8 * 0.551318f - t6 * 0.826977f;
+		float t7New = t6 * 0.110264f - t7 * 0.551318f;
+		float norm = t8New * t8New + t6New * t6New + t7New * t7New;
+		t10 *= t9 >= 0.0f ? 1.0f : 0.0f;
+
+		// allowed distance grows with the amplitude
+		float confidence = 0 < abConfidenceSlope ? irMin : irMax;
+		confidence = std::log(confidence);
+		confidence = (confidence * abConfidenceSlope * 0.301030f + abConfidenceOffset) * 3.321928f;
+		confidence = std::exp(confidence);
+		confidence = std::min(maxDealiasConfidence, std::max(minDealiasConfidence, confidence));
+		confidence *= confidence;
+
+		phase = t10 * (confidence >= norm ? 1.0f : 0.0f);
+	}
+
+	phase = 0 < phase ? phase + phaseOffset : phase;
+
+	const size_t i = (size_t)y * WIDTH + x;
+	const float depthLinear = zTable[i] * phase;
+	const float maxDepth = phase * unambiguousDist * 2;
+	const bool bFit = 0 < depthLinear && 0 < maxDepth;
+	const float xMultiplier = (xTable[i] * 90) / (maxDepth * maxDepth * 8192.0);
+	float depthFit = depthLinear / (-depthLinear * xMultiplier + 1);
+	depthFit = depthFit < 0 ? 0 : depthFit;
+
+	unwrapped.row(PLANE_DEPTH, y)[x] = bFit ? depthFit : depthLinear;
+	unwrapped.row(PLANE_IR_SUM, y)[x] = irSum;
+	if (ir) {
+		const float amplitude = measured.row(PLANE_AMPLITUDE, y)[x] + measured.row(PLANE_AMPLITUDE + 1, y)[x] +
+			measured.row(PLANE_AMPLITUDE + 2, y)[x];
+		ir[(HEIGHT - 1 - y) * WIDTH + x] = std::min(amplitude * 0.3333333f * abOutputMultiplier, 65535.0f);
+	}
+}
+
+static void edgePixel(const DepthPlanes& unwrapped, const DepthPlanes* filtered, float minDepth, float maxDepth,
+	int x, int y, float* depth) {
+	float& out = depth[(HEIGHT - 1 - y) * WIDTH + x];
+	const float raw = unwrapped.row(PLANE_DEPTH, y)[x];
+	if (!(raw >= minDepth && raw <= maxDepth)) {
+		out = 0.0f;
+		return;
+	}
+	if (x < 1 || y < 1 || x > 510 || y > 422) {
+		out = raw;
+		return;
+	}
+
+	const float irSum = unwrapped.row(PLANE_IR_SUM, y)[x];
+	float irSumAcc = irSum;
+	float squaredIrSumAcc = irSum * irSum;
+	float minNeighbour = raw;
+	float maxNeighbour = raw;
+	for (int j = 0; j < 9; j++) {
+		if (j == 4) continue;
+		const int ox = x + j % 3 - 1;
+		const int oy = y + j / 3 - 1;
+		const float otherIrSum = unwrapped.row(PLANE_IR_SUM, oy)[ox];
+		const float otherDepth = unwrapped.row(PLANE_DEPTH, oy)[ox];
+		irSumAcc += otherIrSum;
+		squaredIrSumAcc += otherIrSum * otherIrSum;
+		if (0.0f < otherDepth) {
+			minNeighbour = std::min(minNeighbour, otherDepth);
+			maxNeighbour = std::max(maxNeighbour, otherDepth);
+		}
+	}
+
+	float stdDev = std::sqrt(squaredIrSumAcc * 9.0f - irSumAcc * irSumAcc) / 9.0f;
+	const float edgeAvg = std::max(irSumAcc / 9.0f, edgeAbAvgMinValue);
+	stdDev /= edgeAvg;
+
+	const float absMinDiff = std::abs(raw - minNeighbour);
+	const float absMaxDiff = std::abs(raw - maxNeighbour);
+	const float avgDiff = (absMinDiff + absMaxDiff) * 0.5f;
+	const float maxAbsDiff = std::max(absMinDiff, absMaxDiff);
+
+	const bool bEdge = 0.0f < raw && stdDev >= edgeAbStdDevThreshold && edgeCloseDeltaThreshold < absMinDiff &&
+		edgeFarDeltaThreshold < absMaxDiff && edgeMaxDeltaThreshold < maxAbsDiff && edgeAvgDeltaThreshold < avgDiff;
+	if (bEdge) {
+		out = 0.0f;
+		return;
+	}
+
+	if (filtered && filtered->row(PLANE_EDGE_TEST, y)[x] == 0.0f) {
+		out = 0.0f;
+		return;
+	}
+
+	const float tolerance = 1500.0f > raw ? 30.0f : 0.02f * raw;
+	float edgeCount = 0.0f;
+	for (int j = 0; j < 9; j++) {
+		if (j == 4) continue;
+		const float otherDepth = unwrapped.row(PLANE_DEPTH, y + j / 3 - 1)[x + j % 3 - 1];
+		edgeCount += std::abs(raw - otherDepth) > tolerance ? 1.0f : 0.0f;
+	}
+	out = edgeCount > maxEdgeCount ? 0.0f : raw;
+}
+
+#ifdef KV2_X86
+//--------------------------------------------------------------------------------
+// avx2, 8 pixels of a row at a time. no fma so the products round like the scalar path
+//--------------------------------------------------------------------------------
+
+// cephes expf, nan stays nan
+KV2_TARGET("avx2")
+static inline __m256 expAVX2(__m256 x) {
+	x = _mm256_min_ps(_mm256_set1_ps(88.3762626647949f), x);
+	x = _mm256_max_ps(_mm256_set1_ps(-88.3762626647949f), x);
+	const __m256 fx = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)), _mm256_set1_ps(0.5f)));
+	x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(0.693359375f)));
+	x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(-2.12194440e-4f)));
+	__m256 y = _mm256_set1_ps(1.9875691500e-4f);
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(1.3981999507e-3f));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(8.3334519073e-3f));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(4.1665795894e-2f));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(1.6666665459e-1f));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(5.0000001201e-1f));
+	y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(y, _mm256_mul_ps(x, x)), x), _mm256_set1_ps(1.0f));
+	const __m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+	return _mm256_mul_ps(y, _mm256_castsi256_ps(exponent));
+}
+
+// cephes logf for positive x
+KV2_TARGET("avx2")
+static inline __m256 logAVX2(__m256 x) {
+	x = _mm256_max_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x00800000)));
+	const __m256i bits = _mm256_castps_si256(x);
+	__m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+	x = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f000000)));
+
+	// mantissa in [sqrt(0.5), sqrt(2))
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 small = _mm256_cmp_ps(x, _mm256_set1_ps(0.707106781186547524f), _CMP_LT_OQ);
+	e = _mm256_sub_ps(e, _mm256_and_ps(one, small));
+	x = _mm256_add_ps(_mm256_sub_ps(x, one), _mm256_and_ps(x, small));
+
+	const __m256 z = _mm256_mul_ps(x, x);
+	__m256 y = _mm256_set1_ps(7.0376836292e-2f);
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(-1.1514610310e-1f));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(1.1676998740e-1f));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(-1.2420140846e-1f));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(1.4249322787e-1f));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(-1.6668057665e-1f));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(2.0000714765e-1f));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(-2.4999993993e-1f));
+	y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(3.3333331174e-1f));
+	y = _mm256_mul_ps(_mm256_mul_ps(y, x), z);
+	y = _mm256_add_ps(y, _mm256_mul_ps(e, _mm256_set1_ps(-2.12194440e-4f)));
+	y = _mm256_sub_ps(y, _mm256_mul_ps(z, _mm256_set1_ps(0.5f)));
+	return _mm256_add_ps(_mm256_add_ps(x, y), _mm256_mul_ps(e, _mm256_set1_ps(0.693359375f)));
+}
+
+// atan2 through cephes atanf on min / max of |y| and |x|. 0 for (0, 0), nan for nan
+KV2_TARGET("avx2")
+static inline __m256 atan2AVX2(__m256 y, __m256 x) {
+	const __m256 signMask = _mm256_set1_ps(-0.0f);
+	const __m256 absX = _mm256_andnot_ps(signMask, x);
+	const __m256 absY = _mm256_andnot_ps(signMask, y);
+	const __m256 maxXY = _mm256_max_ps(absX, absY);
+	const __m256 ratio = _mm256_div_ps(_mm256_min_ps(absX, absY), maxXY);
+
+	// atan on [0, 1], above tan(pi / 8) through atan((t - 1) / (t + 1)) + pi / 4
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 upper = _mm256_cmp_ps(ratio, _mm256_set1_ps(0.4142135623730950f), _CMP_GT_OQ);
+	const __m256 t = _mm256_blendv_ps(ratio, _mm256_div_ps(_mm256_sub_ps(ratio, one), _mm256_add_ps(ratio, one)), upper);
+	const __m256 z = _mm256_mul_ps(t, t);
+	__m256 p = _mm256_set1_ps(8.05374449538e-2f);
+	p = _mm256_add_ps(_mm256_mul_ps(p, z), _mm256_set1_ps(-1.38776856032e-1f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, z), _mm256_set1_ps(1.99777106478e-1f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, z), _mm256_set1_ps(-3.33329491539e-1f));
+	__m256 angle = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(p, z), t), t);
+	angle = _mm256_add_ps(angle, _mm256_and_ps(upper, _mm256_set1_ps((float)(PI / 4))));
+
+	// back to the quadrant
+	angle = _mm256_blendv_ps(angle, _mm256_sub_ps(_mm256_set1_ps((float)(PI / 2)), angle), _mm256_cmp_ps(absY, absX, _CMP_GT_OQ));
+	angle = _mm256_blendv_ps(angle, _mm256_sub_ps(_mm256_set1_ps((float)PI), angle), _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ));
+	angle = _mm256_xor_ps(angle, _mm256_and_ps(signMask, _mm256_cmp_ps(y, _mm256_setzero_ps(), _CMP_LT_OQ)));
+
+	const __m256 zero = _mm256_cmp_ps(maxXY, _mm256_setzero_ps(), _CMP_EQ_OQ);
+	return _mm256_andnot_ps(zero, angle);
+}
+
+// 1 / sqrt(norm2) with nan turned into infinity, like libfreenect2 does for its normalization
+KV2_TARGET("avx2")
+static inline __m256 invNormAVX2(__m256 norm2) {
+	const __m256 inv = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(norm2));
+	return _mm256_blendv_ps(inv, _mm256_set1_ps(std::numeric_limits<float>::infinity()), _mm256_cmp_ps(inv, inv, _CMP_UNORD_Q));
+}
+
+KV2_TARGET("avx2")
+static void measureRowAVX2(const unsigned char* packet, const int32_t* lut, const float* trig, const float* zTable,
+	int y, const DepthPlanes& measured) {
+	const int row = y < 212 ? y + 212 : 423 - y;
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i lut0 = _mm256_set1_epi32(lut[0]);
+	const __m256i saturated = _mm256_set1_epi32(32767);
+	const __m256 zero = _mm256_setzero_ps();
+	for (int x = 0; x < WIDTH; x += 8) {
+		const size_t i = (size_t)y * WIDTH + x;
+
+		// bit offset of each pixel in the row, the 32 bit word holding its 11 bits starts at the 16 bit word around it
+		const __m256i xs = _mm256_add_epi32(_mm256_set1_epi32(x), lane);
+		const __m256i column = _mm256_add_epi32(_mm256_srli_epi32(xs, 2), _mm256_slli_epi32(_mm256_and_si256(xs, _mm256_set1_epi32(3)), 7));
+		const __m256i bit = _mm256_mullo_epi32(column, _mm256_set1_epi32(11));
+		const __m256i offset = _mm256_slli_epi32(_mm256_srli_epi32(bit, 4), 1);
+		const __m256i shift = _mm256_and_si256(bit, _mm256_set1_epi32(15));
+		const __m256i border = _mm256_or_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(1), xs), _mm256_cmpgt_epi32(xs, _mm256_set1_epi32(510)));
+		const __m256 valid = _mm256_cmp_ps(zero, _mm256_loadu_ps(zTable + i), _CMP_LT_OQ);
+
+		for (int f = 0; f < 3; f++) {
+			__m256 m[3];
+			__m256i bSaturated = _mm256_setzero_si256();
+			for (int k = 0; k < 3; k++) {
+				const int* src = (const int*)(packet + ofxKinectV2DepthDecoder::SUB_IMAGE_SIZE * (f * 3 + k) + row * 704);
+				const __m256i word = _mm256_i32gather_epi32(src, offset, 1);
+				const __m256i index = _mm256_and_si256(_mm256_srlv_epi32(word, shift), _mm256_set1_epi32(2047));
+				__m256i value = _mm256_i32gather_epi32((const int*)lut, index, 4);
+				value = _mm256_blendv_epi8(value, lut0, border);
+				bSaturated = _mm256_or_si256(bSaturated, _mm256_cmpeq_epi32(value, saturated));
+				m[k] = _mm256_cvtepi32_ps(value);
+			}
+
+			const float* t = trig + f * 6 * NUM_PIXELS + i;
+			__m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(t), m[0]),
+				_mm256_mul_ps(_mm256_loadu_ps(t + NUM_PIXELS), m[1])), _mm256_mul_ps(_mm256_loadu_ps(t + 2 * NUM_PIXELS), m[2]));
+			__m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(t + 3 * NUM_PIXELS), m[0]),
+				_mm256_mul_ps(_mm256_loadu_ps(t + 4 * NUM_PIXELS), m[1])), _mm256_mul_ps(_mm256_loadu_ps(t + 5 * NUM_PIXELS), m[2]));
+			a = _mm256_mul_ps(a, _mm256_set1_ps(abMultiplierPerFrq[f]));
+			b = _mm256_mul_ps(b, _mm256_set1_ps(abMultiplierPerFrq[f]));
+			__m256 amplitude = _mm256_mul_ps(_mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(b, b))), _mm256_set1_ps(abMultiplier));
+
+			const __m256 bSaturatedPs = _mm256_castsi256_ps(bSaturated);
+			a = _mm256_and_ps(valid, _mm256_andnot_ps(bSaturatedPs, a));
+			b = _mm256_and_ps(valid, _mm256_andnot_ps(bSaturatedPs, b));
+			amplitude = _mm256_and_ps(valid, _mm256_blendv_ps(amplitude, _mm256_set1_ps(65535.0f), bSaturatedPs));
+			_mm256_storeu_ps(measured.row(f * 2, y) + x, a);
+			_mm256_storeu_ps(measured.row(f * 2 + 1, y) + x, b);
+			_mm256_storeu_ps(measured.row(PLANE_AMPLITUDE + f, y) + x, amplitude);
+		}
+	}
+}
+
+KV2_TARGET("avx2")
+static void bilateralRowAVX2(const DepthPlanes& measured, int y, const DepthPlanes& filtered) {
+	const float thresholdValue = (jointBilateralAbThreshold * jointBilateralAbThreshold) / (abMultiplier * abMultiplier);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 half = _mm256_set1_ps(0.5f);
+
+	bilateralPixel(measured, 0, y, filtered);
+	int x = 1;
+	for (; x + 8 <= WIDTH - 1; x += 8) {
+		__m256 edgeTest = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int f = 0; f < 3; f++) {
+			const float* rowsA[3] = { measured.row(f * 2, y - 1) + x, measured.row(f * 2, y) + x, measured.row(f * 2, y + 1) + x };
+			const float* rowsB[3] = { measured.row(f * 2 + 1, y - 1) + x, measured.row(f * 2 + 1, y) + x, measured.row(f * 2 + 1, y + 1) + x };
+			const __m256 a = _mm256_loadu_ps(rowsA[1]);
+			const __m256 b = _mm256_loadu_ps(rowsB[1]);
+			const __m256 norm2 = _mm256_add_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(b, b));
+			const __m256 invNorm = invNormAVX2(norm2);
+			const __m256 normalizedA = _mm256_mul_ps(a, invNorm);
+			const __m256 normalizedB = _mm256_mul_ps(b, invNorm);
+
+			const __m256 weak = _mm256_cmp_ps(norm2, _mm256_set1_ps(thresholdValue), _CMP_LT_OQ);
+			const __m256 threshold = _mm256_andnot_ps(weak, _mm256_set1_ps(thresholdValue));
+			const __m256 exponent = _mm256_mul_ps(_mm256_set1_ps(-1.442695f), _mm256_andnot_ps(weak, _mm256_set1_ps(jointBilateralExp)));
+
+			__m256 weightSum = zero;
+			__m256 sumA = zero;
+			__m256 sumB = zero;
+			__m256 distSum = zero;
+			for (int j = 0; j < 9; j++) {
+				const __m256 kernel = _mm256_set1_ps(gaussianKernel[j]);
+				if (j == 4) {
+					weightSum = _mm256_add_ps(weightSum, kernel);
+					sumA = _mm256_add_ps(sumA, _mm256_mul_ps(kernel, a));
+					sumB = _mm256_add_ps(sumB, _mm256_mul_ps(kernel, b));
+					continue;
+				}
+				const int dx = j % 3 - 1;
+				const __m256 otherA = _mm256_loadu_ps(rowsA[j / 3] + dx);
+				const __m256 otherB = _mm256_loadu_ps(rowsB[j / 3] + dx);
+				const __m256 otherNorm2 = _mm256_add_ps(_mm256_mul_ps(otherA, otherA), _mm256_mul_ps(otherB, otherB));
+				const __m256 otherInvNorm = invNormAVX2(otherNorm2);
+				const __m256 dot = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(otherA, otherInvNorm), normalizedA),
+					_mm256_mul_ps(_mm256_mul_ps(otherB, otherInvNorm), normalizedB));
+				const __m256 dist = _mm256_mul_ps(_mm256_sub_ps(one, dot), half);
+
+				const __m256 use = _mm256_cmp_ps(otherNorm2, threshold, _CMP_GE_OQ);
+				const __m256 weight = _mm256_and_ps(use, _mm256_mul_ps(kernel, expAVX2(_mm256_mul_ps(exponent, dist))));
+				distSum = _mm256_add_ps(distSum, _mm256_and_ps(use, dist));
+				sumA = _mm256_add_ps(sumA, _mm256_mul_ps(weight, otherA));
+				sumB = _mm256_add_ps(sumB, _mm256_mul_ps(weight, otherB));
+				weightSum = _mm256_add_ps(weightSum, weight);
+			}
+
+			edgeTest = _mm256_and_ps(edgeTest, _mm256_cmp_ps(distSum, _mm256_set1_ps(jointBilateralMaxEdge), _CMP_LT_OQ));
+			const __m256 hasWeight = _mm256_cmp_ps(zero, weightSum, _CMP_LT_OQ);
+			_mm256_storeu_ps(filtered.row(f * 2, y) + x, _mm256_and_ps(hasWeight, _mm256_div_ps(sumA, weightSum)));
+			_mm256_storeu_ps(filtered.row(f * 2 + 1, y) + x, _mm256_and_ps(hasWeight, _mm256_div_ps(sumB, weightSum)));
+		}
+		_mm256_storeu_ps(filtered.row(PLANE_EDGE_TEST, y) + x, _mm256_and_ps(edgeTest, one));
+	}
+	for (; x < WIDTH; x++) bilateralPixel(measured, x, y, filtered);
+}
+
+KV2_TARGET("avx2")
+static void unwrapRowAVX2(const DepthPlanes& ab, const DepthPlanes& measured, const float* xTable, const float* zTable,
+	int y, const DepthPlanes& unwrapped, float* ir) {
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 third = _mm256_set1_ps(0.333333f);
+	const __m256 twoPi = _mm256_set1_ps((float)(2.0 * PI));
+	for (int x = 0; x < WIDTH; x += 8) {
+		__m256 phases[3];
+		__m256 amplitudes[3];
+		for (int f = 0; f < 3; f++) {
+			const __m256 a = _mm256_loadu_ps(ab.row(f * 2, y) + x);
+			const __m256 b = _mm256_loadu_ps(ab.row(f * 2 + 1, y) + x);
+			__m256 phase = atan2AVX2(b, a);
+			phase = _mm256_add_ps(phase, _mm256_and_ps(_mm256_cmp_ps(phase, zero, _CMP_LT_OQ), twoPi));
+			phases[f] = _mm256_andnot_ps(_mm256_cmp_ps(phase, phase, _CMP_UNORD_Q), phase);
+			amplitudes[f] = _mm256_mul_ps(_mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(b, b))), _mm256_set1_ps(abMultiplier));
+		}
+
+		const __m256 irSum = _mm256_add_ps(_mm256_add_ps(amplitudes[0], amplitudes[1]), amplitudes[2]);
+		const __m256 irMin = _mm256_min_ps(amplitudes[2], _mm256_min_ps(amplitudes[1], amplitudes[0]));
+		const __m256 irMax = _mm256_max_ps(amplitudes[2], _mm256_max_ps(amplitudes[1], amplitudes[0]));
+		const __m256 strong = _mm256_and_ps(_mm256_cmp_ps(irMin, _mm256_set1_ps(individualAbThreshold), _CMP_NLT_UQ),
+			_mm256_cmp_ps(irSum, _mm256_set1_ps(abThreshold), _CMP_NLT_UQ));
+
+		const __m256 t0 = _mm256_mul_ps(phases[0], _mm256_set1_ps((float)(3.0 / (2.0 * PI))));
+		const __m256 t1 = _mm256_mul_ps(phases[1], _mm256_set1_ps((float)(15.0 / (2.0 * PI))));
+		const __m256 t2 = _mm256_mul_ps(phases[2], _mm256_set1_ps((float)(2.0 / (2.0 * PI))));
+
+		const __m256 t5 = _mm256_add_ps(_mm256_mul_ps(_mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(t1, t0), third), half)),
+			_mm256_set1_ps(3.0f)), t0);
+		__m256 t3 = _mm256_sub_ps(t5, t2);
+		const __m256 t4 = _mm256_add_ps(t3, t3);
+		const __m256 c1 = _mm256_cmp_ps(t4, _mm256_sub_ps(zero, t4), _CMP_GE_OQ);
+		const __m256 f1 = _mm256_blendv_ps(_mm256_set1_ps(-2.0f), _mm256_set1_ps(2.0f), c1);
+		const __m256 f2 = _mm256_blendv_ps(_mm256_set1_ps(-0.5f), half, c1);
+		t3 = _mm256_mul_ps(t3, f2);
+		t3 = _mm256_mul_ps(_mm256_sub_ps(t3, _mm256_floor_ps(t3)), f1);
+
+		const __m256 absT3 = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), t3);
+		const __m256 c2 = _mm256_and_ps(_mm256_cmp_ps(half, absT3, _CMP_LT_OQ), _mm256_cmp_ps(absT3, _mm256_set1_ps(1.5f), _CMP_LT_OQ));
+		const __m256 fifteen = _mm256_and_ps(c2, _mm256_set1_ps(15.0f));
+		__m256 t6 = _mm256_add_ps(t5, fifteen);
+		__m256 t7 = _mm256_add_ps(t1, fifteen);
+		__m256 t8 = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(t6, t2), half), half)),
+			_mm256_set1_ps(2.0f)), t2), half);
+
+		t6 = _mm256_mul_ps(t6, third);
+		t7 = _mm256_mul_ps(t7, _mm256_set1_ps(0.066667f));
+		const __m256 t9 = _mm256_add_ps(_mm256_add_ps(t8, t6), t7);
+		__m256 t10 = _mm256_mul_ps(t9, third);
+
+		t6 = _mm256_mul_ps(t6, twoPi);
+		t7 = _mm256_mul_ps(t7, twoPi);
+		t8 = _mm256_mul_ps(t8, twoPi);
+		const __m256 t8New = _mm256_sub_ps(_mm256_mul_ps(t7, _mm256_set1_ps(0.826977f)), _mm256_mul_ps(t8, _mm256_set1_ps(0.110264f)));
+		const __m256 t6New = _mm256_sub_ps(_mm256_mul_ps(t8, _mm256_set1_ps(0.551318f)), _mm256_mul_ps(t6, _mm256_set1_ps(0.826977f)));
+		const __m256 t7New = _mm256_sub_ps(_mm256_mul_ps(t6, _mm256_set1_ps(0.110264f)), _mm256_mul_ps(t7, _mm256_set1_ps(0.551318f)));
+		const __m256 norm = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(t8New, t8New), _mm256_mul_ps(t6New, t6New)), _mm256_mul_ps(t7New, t7New));
+		t10 = _mm256_and_ps(_mm256_cmp_ps(t9, zero, _CMP_GE_OQ), t10);
+
+		__m256 confidence = logAVX2(0 < abConfidenceSlope ? irMin : irMax);
+		confidence = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(confidence, _mm256_set1_ps(abConfidenceSlope)),
+			_mm256_set1_ps(0.301030f)), _mm256_set1_ps(abConfidenceOffset)), _mm256_set1_ps(3.321928f));
+		confidence = expAVX2(confidence);
+		confidence = _mm256_min_ps(_mm256_set1_ps(maxDealiasConfidence), _mm256_max_ps(_mm256_set1_ps(minDealiasConfidence), confidence));
+		confidence = _mm256_mul_ps(confidence, confidence);
+
+		__m256 phase = _mm256_and_ps(_mm256_and_ps(strong, _mm256_cmp_ps(confidence, norm, _CMP_GE_OQ)), t10);
+		phase = _mm256_add_ps(phase, _mm256_and_ps(_mm256_cmp_ps(zero, phase, _CMP_LT_OQ), _mm256_set1_ps(phaseOffset)));
+
+		const size_t i = (size_t)y * WIDTH + x;
+		const __m256 depthLinear = _mm256_mul_ps(_mm256_loadu_ps(zTable + i), phase);
+		const __m256 maxDepth = _mm256_mul_ps(_mm256_mul_ps(phase, _mm256_set1_ps(unambiguousDist)), _mm256_set1_ps(2.0f));
+		const __m256 fit = _mm256_and_ps(_mm256_cmp_ps(zero, depthLinear, _CMP_LT_OQ), _mm256_cmp_ps(zero, maxDepth, _CMP_LT_OQ));
+		const __m256 xMultiplier = _mm256_div_ps(_mm256_mul_ps(_mm256_loadu_ps(xTable + i), _mm256_set1_ps(90.0f)),
+			_mm256_mul_ps(_mm256_mul_ps(maxDepth, maxDepth), _mm256_set1_ps(8192.0f)));
+		__m256 depthFit = _mm256_div_ps(depthLinear, _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(zero, depthLinear), xMultiplier), one));
+		depthFit = _mm256_andnot_ps(_mm256_cmp_ps(depthFit, zero, _CMP_LT_OQ), depthFit);
+
+		_mm256_storeu_ps(unwrapped.row(PLANE_DEPTH, y) + x, _mm256_blendv_ps(depthLinear, depthFit, fit));
+		_mm256_storeu_ps(unwrapped.row(PLANE_IR_SUM, y) + x, irSum);
+		if (ir) {
+			const __m256 amplitude = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(measured.row(PLANE_AMPLITUDE, y) + x),
+				_mm256_loadu_ps(measured.row(PLANE_AMPLITUDE + 1, y) + x)), _mm256_loadu_ps(measured.row(PLANE_AMPLITUDE + 2, y) + x));
+			const __m256 value = _mm256_mul_ps(_mm256_mul_ps(amplitude, _mm256_set1_ps(0.3333333f)), _mm256_set1_ps(abOutputMultiplier));
+			_mm256_storeu_ps(ir + (HEIGHT - 1 - y) * WIDTH + x, _mm256_min_ps(_mm256_set1_ps(65535.0f), value));
+		}
+	}
+}
+
+KV2_TARGET("avx2")
+static void edgeRowAVX2(const DepthPlanes& unwrapped, const DepthPlanes* filtered, float minDepth, float maxDepth,
+	int y, float* depth) {
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 signMask = _mm256_set1_ps(-0.0f);
+	const __m256 ninth = _mm256_set1_ps(9.0f);
+	float* out = depth + (HEIGHT - 1 - y) * WIDTH;
+
+	edgePixel(unwrapped, filtered, minDepth, maxDepth, 0, y, depth);
+	int x = 1;
+	for (; x + 8 <= WIDTH - 1; x += 8) {
+		const float* rowsDepth[3] = { unwrapped.row(PLANE_DEPTH, y - 1) + x, unwrapped.row(PLANE_DEPTH, y) + x, unwrapped.row(PLANE_DEPTH, y + 1) + x };
+		const float* rowsIrSum[3] = { unwrapped.row(PLANE_IR_SUM, y - 1) + x, unwrapped.row(PLANE_IR_SUM, y) + x, unwrapped.row(PLANE_IR_SUM, y + 1) + x };
+		const __m256 raw = _mm256_loadu_ps(rowsDepth[1]);
+		const __m256 irSum = _mm256_loadu_ps(rowsIrSum[1]);
+
+		__m256 irSumAcc = irSum;
+		__m256 squaredIrSumAcc = _mm256_mul_ps(irSum, irSum);
+		__m256 minNeighbour = raw;
+		__m256 maxNeighbour = raw;
+		__m256 others[9];
+		for (int j = 0; j < 9; j++) {
+			if (j == 4) continue;
+			const int dx = j % 3 - 1;
+			const __m256 otherIrSum = _mm256_loadu_ps(rowsIrSum[j / 3] + dx);
+			const __m256 otherDepth = _mm256_loadu_ps(rowsDepth[j / 3] + dx);
+			others[j] = otherDepth;
+			irSumAcc = _mm256_add_ps(irSumAcc, otherIrSum);
+			squaredIrSumAcc = _mm256_add_ps(squaredIrSumAcc, _mm256_mul_ps(otherIrSum, otherIrSum));
+			const __m256 positive = _mm256_cmp_ps(zero, otherDepth, _CMP_LT_OQ);
+			minNeighbour = _mm256_blendv_ps(minNeighbour, _mm256_min_ps(otherDepth, minNeighbour), positive);
+			maxNeighbour = _mm256_blendv_ps(maxNeighbour, _mm256_max_ps(otherDepth, maxNeighbour), positive);
+		}
+
+		__m256 stdDev = _mm256_div_ps(_mm256_sqrt_ps(_mm256_sub_ps(_mm256_mul_ps(squaredIrSumAcc, ninth), _mm256_mul_ps(irSumAcc, irSumAcc))), ninth);
+		stdDev = _mm256_div_ps(stdDev, _mm256_max_ps(_mm256_set1_ps(edgeAbAvgMinValue), _mm256_div_ps(irSumAcc, ninth)));
+
+		const __m256 absMinDiff = _mm256_andnot_ps(signMask, _mm256_sub_ps(raw, minNeighbour));
+		const __m256 absMaxDiff = _mm256_andnot_ps(signMask, _mm256_sub_ps(raw, maxNeighbour));
+		const __m256 avgDiff = _mm256_mul_ps(_mm256_add_ps(absMinDiff, absMaxDiff), _mm256_set1_ps(0.5f));
+		const __m256 maxAbsDiff = _mm256_max_ps(absMaxDiff, absMinDiff);
+
+		__m256 edge = _mm256_cmp_ps(zero, raw, _CMP_LT_OQ);
+		edge = _mm256_and_ps(edge, _mm256_cmp_ps(stdDev, _mm256_set1_ps(edgeAbStdDevThreshold), _CMP_GE_OQ));
+		edge = _mm256_and_ps(edge, _mm256_cmp_ps(_mm256_set1_ps(edgeCloseDeltaThreshold), absMinDiff, _CMP_LT_OQ));
+		edge = _mm256_and_ps(edge, _mm256_cmp_ps(_mm256_set1_ps(edgeFarDeltaThreshold), absMaxDiff, _CMP_LT_OQ));
+		edge = _mm256_and_ps(edge, _mm256_cmp_ps(_mm256_set1_ps(edgeMaxDeltaThreshold), maxAbsDiff, _CMP_LT_OQ));
+		edge = _mm256_and_ps(edge, _mm256_cmp_ps(_mm256_set1_ps(edgeAvgDeltaThreshold), avgDiff, _CMP_LT_OQ));
+
+		const __m256 tolerance = _mm256_blendv_ps(_mm256_mul_ps(_mm256_set1_ps(0.02f), raw), _mm256_set1_ps(30.0f),
+			_mm256_cmp_ps(_mm256_set1_ps(1500.0f), raw, _CMP_GT_OQ));
+		__m256 edgeCount = zero;
+		for (int j = 0; j < 9; j++) {
+			if (j == 4) continue;
+			const __m256 diff = _mm256_andnot_ps(signMask, _mm256_sub_ps(raw, others[j]));
+			edgeCount = _mm256_add_ps(edgeCount, _mm256_and_ps(_mm256_cmp_ps(diff, tolerance, _CMP_GT_OQ), _mm256_set1_ps(1.0f)));
+		}
+
+		__m256 keep = _mm256_andnot_ps(edge, _mm256_cmp_ps(edgeCount, _mm256_set1_ps(maxEdgeCount), _CMP_LE_OQ));
+		if (filtered) keep = _mm256_and_ps(keep, _mm256_cmp_ps(_mm256_loadu_ps(filtered->row(PLANE_EDGE_TEST, y) + x), zero, _CMP_NEQ_OQ));
+		keep = _mm256_and_ps(keep, _mm256_cmp_ps(raw, _mm256_set1_ps(minDepth), _CMP_GE_OQ));
+		keep = _mm256_and_ps(keep, _mm256_cmp_ps(raw, _mm256_set1_ps(maxDepth), _CMP_LE_OQ));
+		_mm256_storeu_ps(out + x, _mm256_and_ps(keep, raw));
+	}
+	for (; x < WIDTH; x++) edgePixel(unwrapped, filtered, minDepth, maxDepth, x, y, depth);
+}
+#endif
+
+//--------------------------------------------------------------------------------
+// row range stages, picking the path per call
+//--------------------------------------------------------------------------------
+static void measureRows(const unsigned char* packet, const int32_t* lut, const float* trig, const float* zTable,
+	int rowBegin, int rowEnd, const DepthPlanes& measured)
+{
+#ifdef KV2_X86
+	if (getSimdLevel() == SIMD_AVX2) {
+		for (int y = rowBegin; y < rowEnd; y++) measureRowAVX2(packet, lut, trig, zTable, y, measured);
+		return;
+	}
+#endif
+	for (int y = rowBegin; y < rowEnd; y++)
+		for (int x = 0; x < WIDTH; x++) measurePixel(packet, lut, trig, zTable, x, y, measured);
+}
+
+static void bilateralRows(const DepthPlanes& measured, int rowBegin, int rowEnd, const DepthPlanes& filtered)
+{
+	for (int y = rowBegin; y < rowEnd; y++) {
+#ifdef KV2_X86
+		if (getSimdLevel() == SIMD_AVX2 && y >= 1 && y <= 422) {
+			bilateralRowAVX2(measured, y, filtered);
+			continue;
+		}
+#endif
+		for (int x = 0; x < WIDTH; x++) bilateralPixel(measured, x, y, filtered);
+	}
+}
+
+static void unwrapRows(const DepthPlanes& ab, const DepthPlanes& measured, const float* xTable, const float* zTable,
+	int rowBegin, int rowEnd, const DepthPlanes& unwrapped, float* ir)
+{
+#ifdef KV2_X86
+	if (getSimdLevel() == SIMD_AVX2) {
+		for (int y = rowBegin; y < rowEnd; y++) unwrapRowAVX2(ab, measured, xTable, zTable, y, unwrapped, ir);
+		return;
+	}
+#endif
+	for (int y = rowBegin; y < rowEnd; y++)
+		for (int x = 0; x < WIDTH; x++) unwrapPixel(ab, measured, xTable, zTable, x, y, unwrapped, ir);
+}
+
+static void edgeRows(const DepthPlanes& unwrapped, const DepthPlanes* filtered, float minDepth, float maxDepth,
+	int rowBegin, int rowEnd, float* depth)
+{
+	for (int y = rowBegin; y < rowEnd; y++) {
+#ifdef KV2_X86
+		if (getSimdLevel() == SIMD_AVX2 && y >= 1 && y <= 422) {
+			edgeRowAVX2(unwrapped, filtered, minDepth, maxDepth, y, depth);
+			continue;
+		}
+#endif
+		for (int x = 0; x < WIDTH; x++) edgePixel(unwrapped, filtered, minDepth, maxDepth, x, y, depth);
+	}
+}
+
+//--------------------------------------------------------------------------------
+ofxKinectV2DepthDecoder::ofxKinectV2DepthDecoder(int numThreads)
+{
+	trigTable.assign(NUM_PIXELS * 18, 0.0f);
+	xTable.assign(NUM_PIXELS, 0.0f);
+	zTable.assign(NUM_PIXELS, 0.0f);
+	lut.assign(LUT_SIZE, 0);
+	setNumThreads(numThreads);
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2DepthDecoder::setNumThreads(int numThreads)
+{
+	if (pool && numThreads == (int)bands.size()) return;
+	pool.reset(new ThreadPool(numThreads));
+
+	// one band per thread, each with room for its rows and the 2 halo rows on either side the filters need
+	bands.resize(pool->getNumThreads());
+	const size_t bandRows = (HEIGHT + bands.size() - 1) / bands.size() + 4;
+	for (auto& band : bands)
+	{
+		band.measured.resize(bandRows * WIDTH * NUM_MEASURED_PLANES);
+		band.filtered.resize(bandRows * WIDTH * NUM_FILTERED_PLANES);
+		band.unwrapped.resize(bandRows * WIDTH * NUM_UNWRAPPED_PLANES);
+	}
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2DepthDecoder::setConfiguration(float minDepth, float maxDepth, bool bilateralFilter, bool edgeAwareFilter)
+{
+	this->minDepth = minDepth * 1000.0f;
+	this->maxDepth = maxDepth * 1000.0f;
+	bBilateralFilter = bilateralFilter;
+	bEdgeAwareFilter = edgeAwareFilter;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2DepthDecoder::loadP0Tables(const uint16_t* p0table0, const uint16_t* p0table1, const uint16_t* p0table2)
+{
+	const uint16_t* tables[3] = { p0table0, p0table1, p0table2 };
+	for (int f = 0; f < 3; f++)
+	{
+		float* trig = &trigTable[f * 6 * NUM_PIXELS];
+		for (int y = 0; y < HEIGHT; y++)
+		{
+			const uint16_t* src = tables[f] + (HEIGHT - 1 - y) * WIDTH;
+			for (int x = 0; x < WIDTH; x++)
+			{
+				const size_t i = (size_t)y * WIDTH + x;
+				const float p0 = -((float)src[x]) * 0.000031 * PI;
+				for (int k = 0; k < 3; k++)
+				{
+					const float phase = p0 + phaseInRad[k];
+					trig[k * NUM_PIXELS + i] = std::cos(phase);
+					trig[(k + 3) * NUM_PIXELS + i] = std::sin(-phase);
+				}
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2DepthDecoder::loadXZTables(const float* xtable, const float* ztable)
+{
+	for (int y = 0; y < HEIGHT; y++)
+	{
+		std::copy(xtable + (HEIGHT - 1 - y) * WIDTH, xtable + (HEIGHT - y) * WIDTH, &xTable[y * WIDTH]);
+		std::copy(ztable + (HEIGHT - 1 - y) * WIDTH, ztable + (HEIGHT - y) * WIDTH, &zTable[y * WIDTH]);
+	}
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2DepthDecoder::loadLookupTable(const short* lut)
+{
+	std::copy(lut, lut + LUT_SIZE, this->lut.begin());
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2DepthDecoder::decode(const unsigned char* packet, float* ir, float* depth)
+{
+	const size_t numBands = bands.size();
+	pool->parallelFor(numBands, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++)
+			decodeBand(packet, (int)(HEIGHT * i / numBands), (int)(HEIGHT * (i + 1) / numBands), bands[i], ir, depth);
+	});
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2DepthDecoder::decodeBand(const unsigned char* packet, int rowBegin, int rowEnd, Band& band, float* ir,
+	float* depth)
+{
+	// the edge filter reads the unwrapped rows above and below, the bilateral filter the measured ones above and below
+	// those, so the band recomputes them instead of waiting for its neighbours
+	const int unwrapBegin = bEdgeAwareFilter ? std::max(rowBegin - 1, 0) : rowBegin;
+	const int unwrapEnd = bEdgeAwareFilter ? std::min(rowEnd + 1, HEIGHT) : rowEnd;
+	const int measureBegin = bBilateralFilter ? std::max(unwrapBegin - 1, 0) : unwrapBegin;
+	const int measureEnd = bBilateralFilter ? std::min(unwrapEnd + 1, HEIGHT) : unwrapEnd;
+
+	const DepthPlanes measuredPlanes = { band.measured.data(), measureBegin, measureEnd - measureBegin };
+	const DepthPlanes filteredPlanes = { band.filtered.data(), unwrapBegin, unwrapEnd - unwrapBegin };
+	const DepthPlanes unwrappedPlanes = { band.unwrapped.data(), unwrapBegin, unwrapEnd - unwrapBegin };
+	const DepthPlanes& abPlanes = bBilateralFilter ? filteredPlanes : measuredPlanes;
+
+	measureRows(packet, lut.data(), trigTable.data(), zTable.data(), measureBegin, measureEnd, measuredPlanes);
+	if (bBilateralFilter) bilateralRows(measuredPlanes, unwrapBegin, unwrapEnd, filteredPlanes);
+
+	// the halo rows' ir belongs to the neighbouring bands
+	unwrapRows(abPlanes, measuredPlanes, xTable.data(), zTable.data(), unwrapBegin, rowBegin, unwrappedPlanes, nullptr);
+	unwrapRows(abPlanes, measuredPlanes, xTable.data(), zTable.data(), rowBegin, rowEnd, unwrappedPlanes, ir);
+	unwrapRows(abPlanes, measuredPlanes, xTable.data(), zTable.data(), rowEnd, unwrapEnd, unwrappedPlanes, nullptr);
+
+	if (bEdgeAwareFilter)
+	{
+		edgeRows(unwrappedPlanes, bBilateralFilter ? &filteredPlanes : nullptr, minDepth, maxDepth, rowBegin, rowEnd, depth);
+	}
+	else
+	{
+		for (int y = rowBegin; y < rowEnd; y++)
+			memcpy(depth + (HEIGHT - 1 - y) * WIDTH, unwrappedPlanes.row(PLANE_DEPTH, y), WIDTH * sizeof(float));
+	}
+}
+
+//--------------------------------------------------------------------------------
+bool ofxKinectV2DepthDecoder::writeRecordingTables(std::ostream& out, const uint16_t* p0tables, const float* xtable,
+	const float* ztable, const short* lut)
+{
+	out.write(RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+	out.write(reinterpret_cast<const char*>(p0tables), NUM_PIXELS * 3 * sizeof(uint16_t));
+	out.write(reinterpret_cast<const char*>(xtable), NUM_PIXELS * sizeof(float));
+	out.write(reinterpret_cast<const char*>(ztable), NUM_PIXELS * sizeof(float));
+	out.write(reinterpret_cast<const char*>(lut), LUT_SIZE * sizeof(short));
+	return out.good();
+}
+
+//--------------------------------------------------------------------------------
+bool ofxKinectV2DepthDecoder::loadRecording(const std::string& path, std::vector<std::vector<unsigned char> >& packets)
+{
+	std::ifstream in(path.c_str(), std::ios::binary);
+	char magic[sizeof(RECORDING_MAGIC)];
+	if (!in.read(magic, sizeof(magic)) || memcmp(magic, RECORDING_MAGIC, sizeof(magic)) != 0)
+		return false;
+
+	std::vector<uint16_t> p0tables(NUM_PIXELS * 3);
+	std::vector<float> xtable(NUM_PIXELS), ztable(NUM_PIXELS);
+	std::vector<short> lut(LUT_SIZE);
+	in.read(reinterpret_cast<char*>(p0tables.data()), p0tables.size() * sizeof(uint16_t));
+	in.read(reinterpret_cast<char*>(xtable.data()), xtable.size() * sizeof(float));
+	in.read(reinterpret_cast<char*>(ztable.data()), ztable.size() * sizeof(float));
+	in.read(reinterpret_cast<char*>(lut.data()), lut.size() * sizeof(short));
+	if (!in)
+		return false;
+
+	loadP0Tables(&p0tables[0], &p0tables[NUM_PIXELS], &p0tables[NUM_PIXELS * 2]);
+	loadXZTables(xtable.data(), ztable.data());
+	loadLookupTable(lut.data());
+
+	// a packet cut short by the end of the file is dropped
+	packets.clear();
+	std::vector<unsigned char> packet(PACKET_SIZE);
+	while (in.read(reinterpret_cast<char*>(packet.data()), PACKET_SIZE))
+		packets.push_back(packet);
+	return true;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2DepthDecoder::makeScene(Scene& scene)
+{
+	uint32_t seed = 3;
+	scene.p0.resize(NUM_PIXELS * 3);
+	for (size_t i = 0; i < scene.p0.size(); i++)
+	{
+		// two bytes of noise per entry
+		seed = seed * 1664525 + 1013904223;
+		const uint16_t low = seed >> 24;
+		seed = seed * 1664525 + 1013904223;
+		scene.p0[i] = low | (uint16_t)((seed >> 24) << 8);
+	}
+
+	scene.xTable.resize(NUM_PIXELS);
+	scene.zTable.resize(NUM_PIXELS);
+	for (int y = 0; y < HEIGHT; y++)
+	{
+		for (int x = 0; x < WIDTH; x++)
+		{
+			const float xd = (x + 0.5f - 256.0f) / 365.0f;
+			const float yd = (y + 0.5f - 212.0f) / 365.0f;
+			scene.xTable[y * WIDTH + x] = 8192 * xd;
+			scene.zTable[y * WIDTH + x] = 6250.0f / 3 / std::sqrt(xd * xd + yd * yd + 1);
+		}
+	}
+
+	scene.lut.resize(LUT_SIZE);
+	short value = 0;
+	for (int i = 0; i < 1024; i++)
+	{
+		scene.lut[i] = value;
+		scene.lut[1024 + i] = -value;
+		value += 1 << (i / 128 - (i >= 128));
+	}
+	scene.lut[1024] = 32767;
+
+	// the decoder unwraps the three phases to u in [0, 30) cycles of the slowest frequency and gives z * 0.3 * u
+	scene.packet.assign(PACKET_SIZE, 0);
+	const double cycles[3] = { 3.0, 15.0, 2.0 };
+	seed = 5;
+	for (int y = 0; y < HEIGHT; y++)
+	{
+		for (int x = 1; x < WIDTH - 1; x++)
+		{
+			const int i = y * WIDTH + x;
+			const float dx = x - 256.0f;
+			const float dy = y - 212.0f;
+			const float depth = dx * dx + dy * dy < 100 * 100 ? 1200.0f : 2500.0f;
+			const double u = depth / (0.3 * scene.zTable[i]);
+
+			// measurements are stored flipped and with the 4 quarters of a row interleaved
+			const int row = y < 212 ? y : 635 - y;
+			const int bit = ((x >> 2) + ((x & 3) << 7)) * 11;
+			for (int f = 0; f < 3; f++)
+			{
+				const double phase = 2 * PI * std::fmod(u, cycles[f]) / cycles[f];
+				const double p0 = -(double)scene.p0[f * NUM_PIXELS + i] * 0.000031 * PI;
+				for (int k = 0; k < 3; k++)
+				{
+					seed = seed * 1664525 + 1013904223;
+					const double sample = 600 * std::cos(phase + p0 + phaseInRad[k]) + ((seed >> 24) & 7) - 3.5;
+
+					// nearest code of the increasing first half, the lower one on a tie
+					const double magnitude = std::abs(sample);
+					int code = (int)(std::lower_bound(scene.lut.begin(), scene.lut.begin() + 1024, magnitude) - scene.lut.begin());
+					if (code == 1024 || (code > 0 && magnitude - scene.lut[code - 1] <= scene.lut[code] - magnitude)) code--;
+					if (sample < 0 && code > 0) code += 1024;
+
+					unsigned char* dst = &scene.packet[SUB_IMAGE_SIZE * (f * 3 + k) + row * 704];
+					for (int b = 0; b < 11; b++)
+						if (code & (1 << b)) dst[(bit + b) / 8] |= 1 << ((bit + b) % 8);
+				}
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2DepthDecoder::loadScene(const Scene& scene)
+{
+	loadP0Tables(&scene.p0[0], &scene.p0[NUM_PIXELS], &scene.p0[NUM_PIXELS * 2]);
+	loadXZTables(scene.xTable.data(), scene.zTable.data());
+	loadLookupTable(scene.lut.data());
+}
+
+#if OFXKINECTV2_DEPTH_PROCESSOR
+
+//--------------------------------------------------------------------------------
+ofxKinectV2DepthProcessor::ofxKinectV2DepthProcessor(int numThreads)
+	: decoder(numThreads), irFrame(newFrame()), depthFrame(newFrame()),
+	p0Tables(NUM_PIXELS * 3), xTable(NUM_PIXELS), zTable(NUM_PIXELS), lut(ofxKinectV2DepthDecoder::LUT_SIZE)
+{
+}
+
+//--------------------------------------------------------------------------------
+ofxKinectV2DepthProcessor::~ofxKinectV2DepthProcessor()
+{
+	delete irFrame;
+	delete depthFrame;
+}
+
+//--------------------------------------------------------------------------------
+bool ofxKinectV2DepthProcessor::record(const std::string& path, int numPackets)
+{
+	std::unique_ptr<std::ofstream> file(new std::ofstream(path.c_str(), std::ios::binary));
+	if (!file->good())
+		return false;
+
+	std::lock_guard<std::mutex> lock(recordMutex);
+	recordFile = std::move(file);
+	recordPackets = numPackets;
+	return ofxKinectV2DepthDecoder::writeRecordingTables(*recordFile, p0Tables.data(), xTable.data(), zTable.data(), lut.data());
+}
+
+//--------------------------------------------------------------------------------
+libfreenect2::Frame* ofxKinectV2DepthProcessor::newFrame()
+{
+	libfreenect2::Frame* frame = new libfreenect2::Frame(ofxKinectV2DepthDecoder::WIDTH, ofxKinectV2DepthDecoder::HEIGHT, 4);
+	frame->format = libfreenect2::Frame::Float;
+	return frame;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2DepthProcessor::setConfiguration(const libfreenect2::DepthPacketProcessor::Config& config)
+{
+	std::lock_guard<std::mutex> lock(configMutex);
+	config_ = config;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2DepthProcessor::loadP0TablesFromCommandResponse(unsigned char* buffer, size_t buffer_length)
+{
+	if (buffer_length < sizeof(libfreenect2::protocol::P0TablesResponse))
+		return;
+
+	// the tables sit at even offsets of the packed response
+	typedef libfreenect2::protocol::P0TablesResponse Response;
+	const size_t offsets[3] = { offsetof(Response, p0table0), offsetof(Response, p0table1), offsetof(Response, p0table2) };
+	for (int i = 0; i < 3; i++)
+		memcpy(&p0Tables[i * NUM_PIXELS], buffer + offsets[i], NUM_PIXELS * sizeof(uint16_t));
+	decoder.loadP0Tables(&p0Tables[0], &p0Tables[NUM_PIXELS], &p0Tables[NUM_PIXELS * 2]);
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2DepthProcessor::loadXZTables(const float* xtable, const float* ztable)
+{
+	std::copy(xtable, xtable + NUM_PIXELS, xTable.begin());
+	std::copy(ztable, ztable + NUM_PIXELS, zTable.begin());
+	decoder.loadXZTables(xtable, ztable);
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2DepthProcessor::loadLookupTable(const short* lut)
+{
+	std::copy(lut, lut + ofxKinectV2DepthDecoder::LUT_SIZE, this->lut.begin());
+	decoder.loadLookupTable(lut);
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2DepthProcessor::process(const libfreenect2::DepthPacket& packet)
+{
+	if (packet.buffer_length < ofxKinectV2DepthDecoder::PACKET_SIZE)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(configMutex);
+		decoder.setConfiguration(config_.MinDepth, config_.MaxDepth, config_.EnableBilateralFilter, config_.EnableEdgeAwareFilter);
+	}
+	decoder.decode(packet.buffer, (float*)irFrame->data, (float*)depthFrame->data);
+
+	{
+		std::lock_guard<std::mutex> lock(recordMutex);
+		if (recordFile)
+		{
+			recordFile->write(reinterpret_cast<const char*>(packet.buffer), ofxKinectV2DepthDecoder::PACKET_SIZE);
+			if (--recordPackets <= 0 || !recordFile->good()) recordFile.reset();
+		}
+	}
+
+	irFrame->timestamp = packet.timestamp;
+	irFrame->sequence = packet.sequence;
+	depthFrame->timestamp = packet.timestamp;
+	depthFrame->sequence = packet.sequence;
+
+	// a listener returning true keeps the frame
+	if (listener_)
+	{
+		if (listener_->onNewFrame(libfreenect2::Frame::Ir, irFrame)) irFrame = newFrame();
+		if (listener_->onNewFrame(libfreenect2::Frame::Depth, depthFrame)) depthFrame = newFrame();
+	}
+}
+
+//--------------------------------------------------------------------------------
+ofxKinectV2DepthPipeline::ofxKinectV2DepthPipeline(int numThreads)
+{
+	// the color decoder CpuPacketPipeline would pick
+#if defined(LIBFREENECT2_WITH_VT_SUPPORT)
+	rgbProcessor = new libfreenect2::VTRgbPacketProcessor();
+#elif defined(LIBFREENECT2_WITH_VAAPI_SUPPORT)
+	rgbProcessor = new libfreenect2::VaapiRgbPacketProcessor();
+	if (!rgbProcessor->good())
+	{
+		delete rgbProcessor;
+		rgbProcessor = new libfreenect2::TurboJpegRgbPacketProcessor();
+	}
+#elif defined(LIBFREENECT2_WITH_TEGRAJPEG_SUPPORT)
+	rgbProcessor = new libfreenect2::TegraJpegRgbPacketProcessor();
+	if (!rgbProcessor->good())
+	{
+		delete rgbProcessor;
+		rgbProcessor = new libfreenect2::TurboJpegRgbPacketProcessor();
+	}
+#else
+	rgbProcessor = new libfreenect2::TurboJpegRgbPacketProcessor();
+#endif
+	depthProcessor = new ofxKinectV2DepthProcessor(numThreads);
+
+	// each decoder runs on a thread of its own like in libfreenect2's pipelines
+	asyncRgbProcessor = new libfreenect2::AsyncPacketProcessor<libfreenect2::RgbPacket>(rgbProcessor);
+	asyncDepthProcessor = new libfreenect2::AsyncPacketProcessor<libfreenect2::DepthPacket>(depthProcessor);
+
+	rgbParser = new libfreenect2::RgbPacketStreamParser();
+	rgbParser->setPacketProcessor(asyncRgbProcessor);
+	depthParser = new libfreenect2::DepthPacketStreamParser();
+	depthParser->setPacketProcessor(asyncDepthProcessor);
+}
+
+//--------------------------------------------------------------------------------
+ofxKinectV2DepthPipeline::~ofxKinectV2DepthPipeline()
+{
+	// the async processors join their threads before the decoders go away
+	delete asyncRgbProcessor;
+	delete asyncDepthProcessor;
+	delete rgbParser;
+	delete depthParser;
+	delete rgbProcessor;
+	delete depthProcessor;
+}
+
+libfreenect2::PacketPipeline::PacketParser* ofxKinectV2DepthPipeline::getRgbPacketParser() const { return rgbParser; }
+libfreenect2::PacketPipeline::PacketParser* ofxKinectV2DepthPipeline::getIrPacketParser() const { return depthParser; }
+libfreenect2::RgbPacketProcessor* ofxKinectV2DepthPipeline::getRgbPacketProcessor() const { return rgbProcessor; }
+libfreenect2::DepthPacketProcessor* ofxKinectV2DepthPipeline::getDepthPacketProcessor() const { return depthProcessor; }
+
+#endif
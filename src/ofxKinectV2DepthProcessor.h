@@ -0,0 +1,188 @@
+//
+//  ofxKinectV2DepthProcessor.h
+//  kinectExample
+//
+//  The depth decode of libfreenect2's CpuDepthPacketProcessor with its hot loops as row range kernels: the 11 bit
+//  unpack through the lookup table with the per frequency phase and amplitude, the bilateral filter, the phase
+//  unwrapping and the edge aware filter. Each kernel has a scalar reference path and an AVX2 path picked by
+//  ofxKinectV2Kernels::getSimdLevel(), the SSSE3 level runs the scalar one.
+//
+//  ofxKinectV2DepthDecoder only needs the public libfreenect2 headers. ofxKinectV2DepthProcessor runs it inside a
+//  device through ofxKinectV2DepthPipeline (PIPELINE_CPU_SIMD), those two derive from internal libfreenect2 classes,
+//  see OFXKINECTV2_DEPTH_PROCESSOR.
+//
+
+#pragma once
+
+#include "ofxKinectV2Kernels.h"
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+// the prebuilt windows and linux libfreenect2 libraries don't export DepthPacketProcessor, the packet parsers and the
+// color decoders, so the processor and its pipeline are only built where libfreenect2 is compiled into the app (the
+// osx project). define it to 1 when linking a libfreenect2 that has those symbols
+#ifndef OFXKINECTV2_DEPTH_PROCESSOR
+#ifdef __APPLE__
+#define OFXKINECTV2_DEPTH_PROCESSOR 1
+#else
+#define OFXKINECTV2_DEPTH_PROCESSOR 0
+#endif
+#endif
+
+#if OFXKINECTV2_DEPTH_PROCESSOR
+#include <libfreenect2/depth_packet_processor.h>
+#include <libfreenect2/packet_pipeline.h>
+#include <libfreenect2/rgb_packet_processor.h>
+#include <fstream>
+#include <mutex>
+
+namespace libfreenect2 {
+	class RgbPacketStreamParser;
+	class DepthPacketStreamParser;
+}
+#endif
+
+class ofxKinectV2DepthDecoder {
+public:
+	static const int WIDTH = 512;
+	static const int HEIGHT = 424;
+	// a depth packet holds 10 sub images of 11 bit measurements, 3 phases for each of 3 frequencies and one unused
+	static const size_t SUB_IMAGE_SIZE = WIDTH * HEIGHT * 11 / 8;
+	static const size_t PACKET_SIZE = SUB_IMAGE_SIZE * 10;
+	static const size_t LUT_SIZE = 2048;
+
+	// 0 threads uses all hardware threads
+	ofxKinectV2DepthDecoder(int numThreads = 0);
+
+	// threads decode() splits a packet across, the calling thread counts as one. every thread takes a band of rows
+	// and also computes the couple of rows around it the filters read, so the stages of a band run without waiting
+	// for the other bands. not thread safe against decode()
+	void setNumThreads(int numThreads);
+	int getNumThreads() const { return (int)bands.size(); }
+
+	// what libfreenect2::Freenect2Device::Config holds: the depth range in metres and the two filters. like
+	// libfreenect2 the range is applied by the edge aware filter, without it depth isn't clipped
+	void setConfiguration(float minDepth, float maxDepth, bool bilateralFilter, bool edgeAwareFilter);
+
+	// the device tables in the layout libfreenect2 hands them to its processors, WIDTH x HEIGHT each
+	void loadP0Tables(const uint16_t* p0table0, const uint16_t* p0table1, const uint16_t* p0table2);
+	void loadXZTables(const float* xtable, const float* ztable);
+	void loadLookupTable(const short* lut);
+
+	// PACKET_SIZE bytes to WIDTH x HEIGHT ir (0-65535) and depth (mm, 0 = invalid) frames. the scalar path gives the
+	// results of libfreenect2's cpu decoder, AVX2 differs by float rounding in atan2, log and exp
+	void decode(const unsigned char* packet, float* ir, float* depth);
+
+	// recordings hold the device tables followed by raw packets, ofxKinectV2DepthProcessor::record() writes them.
+	// loadRecording() loads the tables and returns the packets, false if the file isn't a recording
+	static bool writeRecordingTables(std::ostream& out, const uint16_t* p0tables, const float* xtable, const float* ztable,
+		const short* lut);
+	bool loadRecording(const std::string& path, std::vector<std::vector<unsigned char> >& packets);
+
+	// device like tables (a pinhole camera, the firmware's 11 to 16 bit lookup table, noise for the p0 tables) and a
+	// packet of a wall at 2.5 m with a disc at 1.2 m in front of it, 3 phase shifted samples of the modulation per
+	// frequency with a little noise. for timing decoders without a device, the filters and the unwrapping take the
+	// branches they take on a plain indoor scene
+	struct Scene {
+		std::vector<uint16_t> p0; // the 3 tables back to back
+		std::vector<float> xTable;
+		std::vector<float> zTable;
+		std::vector<short> lut;
+		std::vector<unsigned char> packet;
+	};
+	static void makeScene(Scene& scene);
+	void loadScene(const Scene& scene);
+
+private:
+	// per band stage planes for the band's rows and its halo: a, b for each frequency then the 3 amplitudes;
+	// the filtered a, b and the edge test; the unwrapped depth and the summed amplitude
+	struct Band {
+		std::vector<float> measured;
+		std::vector<float> filtered;
+		std::vector<float> unwrapped;
+	};
+
+	void decodeBand(const unsigned char* packet, int rowBegin, int rowEnd, Band& band, float* ir, float* depth);
+
+	float minDepth = 500.0f;
+	float maxDepth = 4500.0f;
+	bool bBilateralFilter = true;
+	bool bEdgeAwareFilter = true;
+
+	// cos and sin of the three phases per frequency, 6 planes for each, and the x and z tables, rows flipped like the
+	// measurements. the lookup table is widened to int for the gathers
+	std::vector<float> trigTable;
+	std::vector<float> xTable;
+	std::vector<float> zTable;
+	std::vector<int32_t> lut;
+
+	std::vector<Band> bands;
+	std::unique_ptr<ofxKinectV2Kernels::ThreadPool> pool;
+};
+
+#if OFXKINECTV2_DEPTH_PROCESSOR
+
+// libfreenect2 depth processor running ofxKinectV2DepthDecoder
+class ofxKinectV2DepthProcessor : public libfreenect2::DepthPacketProcessor {
+public:
+	ofxKinectV2DepthProcessor(int numThreads = 0);
+	virtual ~ofxKinectV2DepthProcessor();
+
+	// write the device tables and the next numPackets packets to path, see ofxKinectV2DepthDecoder::loadRecording().
+	// the device sends the tables when it starts, record after that
+	bool record(const std::string& path, int numPackets);
+
+	// may come from another thread while packets are decoded, the next packet picks it up
+	virtual void setConfiguration(const libfreenect2::DepthPacketProcessor::Config& config);
+
+	virtual void loadP0TablesFromCommandResponse(unsigned char* buffer, size_t buffer_length);
+	virtual void loadXZTables(const float* xtable, const float* ztable);
+	virtual void loadLookupTable(const short* lut);
+
+	virtual const char* name() { return "ofxKinectV2 CPU"; }
+	virtual void process(const libfreenect2::DepthPacket& packet);
+
+private:
+	static libfreenect2::Frame* newFrame();
+
+	ofxKinectV2DepthDecoder decoder;
+	std::mutex configMutex;
+	libfreenect2::Frame* irFrame;
+	libfreenect2::Frame* depthFrame;
+
+	// the tables as the device sent them, for recordings
+	std::vector<uint16_t> p0Tables;
+	std::vector<float> xTable;
+	std::vector<float> zTable;
+	std::vector<short> lut;
+	std::mutex recordMutex;
+	std::unique_ptr<std::ofstream> recordFile;
+	int recordPackets = 0;
+};
+
+// libfreenect2's CpuPacketPipeline with ofxKinectV2DepthProcessor for the depth. the device deletes it
+class ofxKinectV2DepthPipeline : public libfreenect2::PacketPipeline {
+public:
+	// numThreads for the depth decoder, 0 uses all hardware threads
+	ofxKinectV2DepthPipeline(int numThreads = 0);
+	virtual ~ofxKinectV2DepthPipeline();
+
+	virtual PacketParser* getRgbPacketParser() const;
+	virtual PacketParser* getIrPacketParser() const;
+	virtual libfreenect2::RgbPacketProcessor* getRgbPacketProcessor() const;
+	virtual libfreenect2::DepthPacketProcessor* getDepthPacketProcessor() const;
+
+private:
+	libfreenect2::RgbPacketStreamParser* rgbParser;
+	libfreenect2::DepthPacketStreamParser* depthParser;
+	libfreenect2::RgbPacketProcessor* rgbProcessor;
+	ofxKinectV2DepthProcessor* depthProcessor;
+	libfreenect2::BaseRgbPacketProcessor* asyncRgbProcessor;
+	libfreenect2::BaseDepthPacketProcessor* asyncDepthProcessor;
+};
+
+#endif
@@ -0,0 +1,1342 @@
+//
+//  ofxKinectV2Kernels.cpp
+//  kinectExample
+//
+
+#include "ofxKinectV2Kernels.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define KV2_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define KV2_TARGET(x)
+#else
+#include <cpuid.h>
+#define KV2_TARGET(x) __attribute__((target(x)))
+#endif
+#endif
+
+namespace ofxKinectV2Kernels {
+
+//--------------------------------------------------------------------------------
+static SimdLevel detectSimdLevel() {
+#ifdef KV2_X86
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	int numIds = info[0];
+	__cpuid(info, 1);
+	bool ssse3 = (info[2] & (1 << 9)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	bool f16c = (info[2] & (1 << 29)) != 0;
+	bool avx2 = false;
+	if (numIds >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6) {
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	bool ssse3 = __builtin_cpu_supports("ssse3");
+	bool avx2 = __builtin_cpu_supports("avx2");
+	unsigned int eax, ebx, ecx = 0, edx;
+	__get_cpuid(1, &eax, &ebx, &ecx, &edx);
+	bool f16c = (ecx & (1 << 29)) != 0;
+#endif
+	// the avx2 level uses F16C for the packed point cloud too, every avx2 cpu has it
+	if (avx2 && f16c) return SIMD_AVX2;
+	if (ssse3) return SIMD_SSSE3;
+#endif
+	return SIMD_SCALAR;
+}
+
+static SimdLevel supportedLevel() {
+	static const SimdLevel level = detectSimdLevel();
+	return level;
+}
+
+static std::atomic<int> activeLevel(-1);
+
+//--------------------------------------------------------------------------------
+SimdLevel getSimdLevel() {
+	int level = activeLevel.load(std::memory_order_relaxed);
+	if (level < 0) {
+		level = supportedLevel();
+		activeLevel.store(level, std::memory_order_relaxed);
+	}
+	return (SimdLevel)level;
+}
+
+//--------------------------------------------------------------------------------
+void setSimdLevel(SimdLevel level) {
+	if (level > supportedLevel()) level = supportedLevel();
+	activeLevel.store(level, std::memory_order_relaxed);
+}
+
+//--------------------------------------------------------------------------------
+const char* getSimdLevelName(SimdLevel level) {
+	switch (level) {
+	case SIMD_AVX2: return "AVX2";
+	case SIMD_SSSE3: return "SSSE3";
+	default: return "scalar";
+	}
+}
+
+//--------------------------------------------------------------------------------
+// BGRX -> RGBA
+//--------------------------------------------------------------------------------
+static void convertBGRXToRGBAScalar(const uint8_t* src, uint8_t* dst, size_t numPixels) {
+	for (size_t i = 0; i < numPixels; i++, src += 4, dst += 4) {
+		uint8_t b = src[0];
+		uint8_t g = src[1];
+		uint8_t r = src[2];
+		uint8_t x = src[3];
+		dst[0] = r;
+		dst[1] = g;
+		dst[2] = b;
+		dst[3] = x;
+	}
+}
+
+#ifdef KV2_X86
+KV2_TARGET("ssse3")
+static void convertBGRXToRGBASSSE3(const uint8_t* src, uint8_t* dst, size_t numPixels) {
+	const __m128i mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	size_t i = 0;
+	for (; i + 16 <= numPixels; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(src + i * 4));
+		__m128i b = _mm_loadu_si128((const __m128i*)(src + i * 4 + 16));
+		__m128i c = _mm_loadu_si128((const __m128i*)(src + i * 4 + 32));
+		__m128i d = _mm_loadu_si128((const __m128i*)(src + i * 4 + 48));
+		_mm_storeu_si128((__m128i*)(dst + i * 4), _mm_shuffle_epi8(a, mask));
+		_mm_storeu_si128((__m128i*)(dst + i * 4 + 16), _mm_shuffle_epi8(b, mask));
+		_mm_storeu_si128((__m128i*)(dst + i * 4 + 32), _mm_shuffle_epi8(c, mask));
+		_mm_storeu_si128((__m128i*)(dst + i * 4 + 48), _mm_shuffle_epi8(d, mask));
+	}
+	convertBGRXToRGBAScalar(src + i * 4, dst + i * 4, numPixels - i);
+}
+
+KV2_TARGET("avx2")
+static void convertBGRXToRGBAAVX2(const uint8_t* src, uint8_t* dst, size_t numPixels) {
+	const __m256i mask = _mm256_setr_epi8(
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	size_t i = 0;
+	for (; i + 32 <= numPixels; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i*)(src + i * 4));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(src + i * 4 + 32));
+		__m256i c = _mm256_loadu_si256((const __m256i*)(src + i * 4 + 64));
+		__m256i d = _mm256_loadu_si256((const __m256i*)(src + i * 4 + 96));
+		_mm256_storeu_si256((__m256i*)(dst + i * 4), _mm256_shuffle_epi8(a, mask));
+		_mm256_storeu_si256((__m256i*)(dst + i * 4 + 32), _mm256_shuffle_epi8(b, mask));
+		_mm256_storeu_si256((__m256i*)(dst + i * 4 + 64), _mm256_shuffle_epi8(c, mask));
+		_mm256_storeu_si256((__m256i*)(dst + i * 4 + 96), _mm256_shuffle_epi8(d, mask));
+	}
+	convertBGRXToRGBAScalar(src + i * 4, dst + i * 4, numPixels - i);
+}
+#endif
+
+//--------------------------------------------------------------------------------
+void convertBGRXToRGBA(const uint8_t* src, uint8_t* dst, size_t numPixels) {
+#ifdef KV2_X86
+	switch (getSimdLevel()) {
+	case SIMD_AVX2: convertBGRXToRGBAAVX2(src, dst, numPixels); return;
+	case SIMD_SSSE3: convertBGRXToRGBASSSE3(src, dst, numPixels); return;
+	default: break;
+	}
+#endif
+	convertBGRXToRGBAScalar(src, dst, numPixels);
+}
+
+//--------------------------------------------------------------------------------
+// box downscale
+//--------------------------------------------------------------------------------
+static void downscaleBGRXScalar(const uint8_t* src, size_t srcWidth, size_t factor, int shift, size_t y,
+	size_t xBegin, size_t xEnd, uint8_t* dst) {
+	const size_t dstWidth = srcWidth / factor;
+	const uint32_t round = (1u << shift) >> 1;
+	for (size_t x = xBegin; x < xEnd; x++) {
+		uint32_t sum[4] = { 0, 0, 0, 0 };
+		for (size_t dy = 0; dy < factor; dy++) {
+			const uint8_t* p = src + ((y * factor + dy) * srcWidth + x * factor) * 4;
+			for (size_t dx = 0; dx < factor; dx++, p += 4) {
+				sum[0] += p[0]; sum[1] += p[1]; sum[2] += p[2]; sum[3] += p[3];
+			}
+		}
+		uint8_t* out = dst + (y * dstWidth + x) * 4;
+		for (int c = 0; c < 4; c++) out[c] = (uint8_t)((sum[c] + round) >> shift);
+	}
+}
+
+#ifdef KV2_X86
+KV2_TARGET("ssse3")
+static void downscaleBGRXSSSE3(const uint8_t* src, size_t srcWidth, size_t factor, int shift, size_t y, uint8_t* dst) {
+	const size_t dstWidth = srcWidth / factor;
+	const size_t rowBytes = srcWidth * 4;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16((short)((1 << shift) >> 1));
+	const __m128i count = _mm_cvtsi32_si128(shift);
+	const uint8_t* top = src + y * factor * rowBytes;
+	uint8_t* out = dst + y * dstWidth * 4;
+
+	// 16 bit sums of 4 source pixels down the box, 8 rows of 8 pixels of 255 still fit
+	auto sumColumns = [&](size_t srcX, __m128i& lo, __m128i& hi) {
+		const uint8_t* p = top + srcX * 4;
+		lo = zero;
+		hi = zero;
+		for (size_t dy = 0; dy < factor; dy++, p += rowBytes) {
+			__m128i v = _mm_loadu_si128((const __m128i*)p);
+			lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+			hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+		}
+	};
+
+	size_t x = 0;
+	if (factor == 2) {
+		for (; x + 2 <= dstWidth; x += 2) {
+			__m128i lo, hi;
+			sumColumns(x * 2, lo, hi);
+			__m128i pairs = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+			pairs = _mm_srl_epi16(_mm_add_epi16(pairs, round), count);
+			_mm_storel_epi64((__m128i*)(out + x * 4), _mm_packus_epi16(pairs, pairs));
+		}
+	}
+	else {
+		for (; x < dstWidth; x++) {
+			__m128i sum = zero;
+			for (size_t chunk = 0; chunk < factor; chunk += 4) {
+				__m128i lo, hi;
+				sumColumns(x * factor + chunk, lo, hi);
+				__m128i pairs = _mm_add_epi16(lo, hi);
+				sum = _mm_add_epi16(sum, _mm_add_epi16(pairs, _mm_srli_si128(pairs, 8)));
+			}
+			sum = _mm_srl_epi16(_mm_add_epi16(sum, round), count);
+			*(int32_t*)(out + x * 4) = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+		}
+	}
+	downscaleBGRXScalar(src, srcWidth, factor, shift, y, x, dstWidth, dst);
+}
+#endif
+
+//--------------------------------------------------------------------------------
+void downscaleBGRX(const uint8_t* src, size_t srcWidth, size_t factor, size_t rowBegin, size_t rowEnd, uint8_t* dst) {
+	int shift = 0;
+	while ((size_t)1 << shift < factor) shift++;
+	shift *= 2;
+	for (size_t y = rowBegin; y < rowEnd; y++) {
+#ifdef KV2_X86
+		if (getSimdLevel() >= SIMD_SSSE3) {
+			downscaleBGRXSSSE3(src, srcWidth, factor, shift, y, dst);
+			continue;
+		}
+#endif
+		downscaleBGRXScalar(src, srcWidth, factor, shift, y, 0, srcWidth / factor, dst);
+	}
+}
+
+//--------------------------------------------------------------------------------
+// float scale / float -> uint16
+//--------------------------------------------------------------------------------
+static void copyScaledScalar(const float* src, float* dst, size_t numPixels, float scale) {
+	for (size_t i = 0; i < numPixels; i++) {
+		dst[i] = src[i] * scale;
+	}
+}
+
+static void convertFloatToShortScalar(const float* src, uint16_t* dst, size_t numPixels) {
+	for (size_t i = 0; i < numPixels; i++) {
+		float v = src[i];
+		// written so that NaN ends up as 0
+		if (!(v > 0.0f)) v = 0.0f;
+		if (v > 65535.0f) v = 65535.0f;
+		dst[i] = (uint16_t)(v + 0.5f);
+	}
+}
+
+#ifdef KV2_X86
+KV2_TARGET("ssse3")
+static void copyScaledSSSE3(const float* src, float* dst, size_t numPixels, float scale) {
+	const __m128 s = _mm_set1_ps(scale);
+	size_t i = 0;
+	for (; i + 8 <= numPixels; i += 8) {
+		__m128 a = _mm_loadu_ps(src + i);
+		__m128 b = _mm_loadu_ps(src + i + 4);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(a, s));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(b, s));
+	}
+	copyScaledScalar(src + i, dst + i, numPixels - i, scale);
+}
+
+KV2_TARGET("avx2")
+static void copyScaledAVX2(const float* src, float* dst, size_t numPixels, float scale) {
+	const __m256 s = _mm256_set1_ps(scale);
+	size_t i = 0;
+	for (; i + 16 <= numPixels; i += 16) {
+		__m256 a = _mm256_loadu_ps(src + i);
+		__m256 b = _mm256_loadu_ps(src + i + 8);
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(a, s));
+		_mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(b, s));
+	}
+	copyScaledScalar(src + i, dst + i, numPixels - i, scale);
+}
+
+KV2_TARGET("ssse3")
+static void convertFloatToShortSSSE3(const float* src, uint16_t* dst, size_t numPixels) {
+	// no packus_epi32 before SSE4.1, so pack signed around a 32768 bias instead
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 top = _mm_set1_ps(65535.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128i bias = _mm_set1_epi32(32768);
+	const __m128i flip = _mm_set1_epi16((short)0x8000);
+	size_t i = 0;
+	for (; i + 8 <= numPixels; i += 8) {
+		__m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i), zero), top);
+		__m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 4), zero), top);
+		__m128i ia = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(a, half)), bias);
+		__m128i ib = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(b, half)), bias);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(_mm_packs_epi32(ia, ib), flip));
+	}
+	convertFloatToShortScalar(src + i, dst + i, numPixels - i);
+}
+
+KV2_TARGET("avx2")
+static void convertFloatToShortAVX2(const float* src, uint16_t* dst, size_t numPixels) {
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 top = _mm256_set1_ps(65535.0f);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	size_t i = 0;
+	for (; i + 16 <= numPixels; i += 16) {
+		__m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src + i), zero), top);
+		__m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src + i + 8), zero), top);
+		__m256i ia = _mm256_cvttps_epi32(_mm256_add_ps(a, half));
+		__m256i ib = _mm256_cvttps_epi32(_mm256_add_ps(b, half));
+		// packus works per 128 bit lane, fix the order afterwards
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(ia, ib), 0xD8);
+		_mm256_storeu_si256((__m256i*)(dst + i), packed);
+	}
+	convertFloatToShortScalar(src + i, dst + i, numPixels - i);
+}
+#endif
+
+//--------------------------------------------------------------------------------
+void copyScaled(const float* src, float* dst, size_t numPixels, float scale) {
+#ifdef KV2_X86
+	switch (getSimdLevel()) {
+	case SIMD_AVX2: copyScaledAVX2(src, dst, numPixels, scale); return;
+	case SIMD_SSSE3: copyScaledSSSE3(src, dst, numPixels, scale); return;
+	default: break;
+	}
+#endif
+	copyScaledScalar(src, dst, numPixels, scale);
+}
+
+//--------------------------------------------------------------------------------
+void convertFloatToShort(const float* src, uint16_t* dst, size_t numPixels) {
+#ifdef KV2_X86
+	switch (getSimdLevel()) {
+	case SIMD_AVX2: convertFloatToShortAVX2(src, dst, numPixels); return;
+	case SIMD_SSSE3: convertFloatToShortSSSE3(src, dst, numPixels); return;
+	default: break;
+	}
+#endif
+	convertFloatToShortScalar(src, dst, numPixels);
+}
+
+//--------------------------------------------------------------------------------
+// temporal depth filters
+//--------------------------------------------------------------------------------
+// same results as minps/maxps, also for NaN, so every path agrees bit for bit
+static inline float minScalar(float a, float b) { return a < b ? a : b; }
+static inline float maxScalar(float a, float b) { return a > b ? a : b; }
+
+static void medianDepthScalar(const float* const* frames, size_t numFrames, float* dst, size_t begin, size_t end) {
+	if (numFrames == 3) {
+		for (size_t i = begin; i < end; i++) {
+			float a = frames[0][i], b = frames[1][i], c = frames[2][i];
+			dst[i] = maxScalar(minScalar(a, b), minScalar(maxScalar(a, b), c));
+		}
+		return;
+	}
+	for (size_t i = begin; i < end; i++) {
+		float v[5] = { frames[0][i], frames[1][i], frames[2][i], frames[3][i], frames[4][i] };
+		// 7 compare exchanges that leave the median in v[2]
+		static const int net[7][2] = { { 0, 1 }, { 3, 4 }, { 0, 3 }, { 1, 4 }, { 1, 2 }, { 2, 3 }, { 1, 2 } };
+		for (auto& p : net) {
+			float lo = minScalar(v[p[0]], v[p[1]]);
+			v[p[1]] = maxScalar(v[p[0]], v[p[1]]);
+			v[p[0]] = lo;
+		}
+		dst[i] = v[2];
+	}
+}
+
+static void smoothDepthScalar(const float* depth, float* state, float* dst, size_t numPixels, float follow, float threshold) {
+	for (size_t i = 0; i < numPixels; i++) {
+		float z = depth[i];
+		float s = state[i];
+		float d = z - s;
+		s = (z > 0.0f && s > 0.0f && std::fabs(d) <= threshold) ? s + d * follow : z;
+		state[i] = s;
+		dst[i] = s;
+	}
+}
+
+#ifdef KV2_X86
+KV2_TARGET("ssse3")
+static void medianDepthSSSE3(const float* const* frames, size_t numFrames, float* dst, size_t numPixels) {
+	size_t i = 0;
+	if (numFrames == 3) {
+		for (; i + 4 <= numPixels; i += 4) {
+			__m128 a = _mm_loadu_ps(frames[0] + i);
+			__m128 b = _mm_loadu_ps(frames[1] + i);
+			__m128 c = _mm_loadu_ps(frames[2] + i);
+			_mm_storeu_ps(dst + i, _mm_max_ps(_mm_min_ps(a, b), _mm_min_ps(_mm_max_ps(a, b), c)));
+		}
+	}
+	else {
+		for (; i + 4 <= numPixels; i += 4) {
+			__m128 v[5];
+			for (int k = 0; k < 5; k++) v[k] = _mm_loadu_ps(frames[k] + i);
+			static const int net[7][2] = { { 0, 1 }, { 3, 4 }, { 0, 3 }, { 1, 4 }, { 1, 2 }, { 2, 3 }, { 1, 2 } };
+			for (auto& p : net) {
+				__m128 lo = _mm_min_ps(v[p[0]], v[p[1]]);
+				v[p[1]] = _mm_max_ps(v[p[0]], v[p[1]]);
+				v[p[0]] = lo;
+			}
+			_mm_storeu_ps(dst + i, v[2]);
+		}
+	}
+	medianDepthScalar(frames, numFrames, dst, i, numPixels);
+}
+
+KV2_TARGET("avx2")
+static void medianDepthAVX2(const float* const* frames, size_t numFrames, float* dst, size_t numPixels) {
+	size_t i = 0;
+	if (numFrames == 3) {
+		for (; i + 8 <= numPixels; i += 8) {
+			__m256 a = _mm256_loadu_ps(frames[0] + i);
+			__m256 b = _mm256_loadu_ps(frames[1] + i);
+			__m256 c = _mm256_loadu_ps(frames[2] + i);
+			_mm256_storeu_ps(dst + i, _mm256_max_ps(_mm256_min_ps(a, b), _mm256_min_ps(_mm256_max_ps(a, b), c)));
+		}
+	}
+	else {
+		for (; i + 8 <= numPixels; i += 8) {
+			__m256 v[5];
+			for (int k = 0; k < 5; k++) v[k] = _mm256_loadu_ps(frames[k] + i);
+			static const int net[7][2] = { { 0, 1 }, { 3, 4 }, { 0, 3 }, { 1, 4 }, { 1, 2 }, { 2, 3 }, { 1, 2 } };
+			for (auto& p : net) {
+				__m256 lo = _mm256_min_ps(v[p[0]], v[p[1]]);
+				v[p[1]] = _mm256_max_ps(v[p[0]], v[p[1]]);
+				v[p[0]] = lo;
+			}
+			_mm256_storeu_ps(dst + i, v[2]);
+		}
+	}
+	medianDepthScalar(frames, numFrames, dst, i, numPixels);
+}
+
+KV2_TARGET("ssse3")
+static void smoothDepthSSSE3(const float* depth, float* state, float* dst, size_t numPixels, float follow, float threshold) {
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 k = _mm_set1_ps(follow);
+	const __m128 t = _mm_set1_ps(threshold);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	size_t i = 0;
+	for (; i + 4 <= numPixels; i += 4) {
+		__m128 z = _mm_loadu_ps(depth + i);
+		__m128 s = _mm_loadu_ps(state + i);
+		__m128 d = _mm_sub_ps(z, s);
+		__m128 keep = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(z, zero), _mm_cmpgt_ps(s, zero)), _mm_cmple_ps(_mm_and_ps(d, absMask), t));
+		s = _mm_or_ps(_mm_and_ps(keep, _mm_add_ps(s, _mm_mul_ps(d, k))), _mm_andnot_ps(keep, z));
+		_mm_storeu_ps(state + i, s);
+		_mm_storeu_ps(dst + i, s);
+	}
+	smoothDepthScalar(depth + i, state + i, dst + i, numPixels - i, follow, threshold);
+}
+
+KV2_TARGET("avx2")
+static void smoothDepthAVX2(const float* depth, float* state, float* dst, size_t numPixels, float follow, float threshold) {
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 k = _mm256_set1_ps(follow);
+	const __m256 t = _mm256_set1_ps(threshold);
+	const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	size_t i = 0;
+	for (; i + 8 <= numPixels; i += 8) {
+		__m256 z = _mm256_loadu_ps(depth + i);
+		__m256 s = _mm256_loadu_ps(state + i);
+		__m256 d = _mm256_sub_ps(z, s);
+		__m256 keep = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(z, zero, _CMP_GT_OQ), _mm256_cmp_ps(s, zero, _CMP_GT_OQ)),
+			_mm256_cmp_ps(_mm256_and_ps(d, absMask), t, _CMP_LE_OQ));
+		s = _mm256_blendv_ps(z, _mm256_add_ps(s, _mm256_mul_ps(d, k)), keep);
+		_mm256_storeu_ps(state + i, s);
+		_mm256_storeu_ps(dst + i, s);
+	}
+	smoothDepthScalar(depth + i, state + i, dst + i, numPixels - i, follow, threshold);
+}
+#endif
+
+//--------------------------------------------------------------------------------
+void medianDepth(const float* const* frames, size_t numFrames, float* dst, size_t numPixels) {
+	if (numFrames != 3 && numFrames != 5) {
+		if (dst != frames[0]) std::memcpy(dst, frames[0], numPixels * sizeof(float));
+		return;
+	}
+#ifdef KV2_X86
+	switch (getSimdLevel()) {
+	case SIMD_AVX2: medianDepthAVX2(frames, numFrames, dst, numPixels); return;
+	case SIMD_SSSE3: medianDepthSSSE3(frames, numFrames, dst, numPixels); return;
+	default: break;
+	}
+#endif
+	medianDepthScalar(frames, numFrames, dst, 0, numPixels);
+}
+
+//--------------------------------------------------------------------------------
+void smoothDepth(const float* depth, float* state, float* dst, size_t numPixels, float smoothing, float threshold) {
+	const float follow = 1.0f - smoothing;
+#ifdef KV2_X86
+	switch (getSimdLevel()) {
+	case SIMD_AVX2: smoothDepthAVX2(depth, state, dst, numPixels, follow, threshold); return;
+	case SIMD_SSSE3: smoothDepthSSSE3(depth, state, dst, numPixels, follow, threshold); return;
+	default: break;
+	}
+#endif
+	smoothDepthScalar(depth, state, dst, numPixels, follow, threshold);
+}
+
+//--------------------------------------------------------------------------------
+// background model
+//--------------------------------------------------------------------------------
+static void accumulateBackgroundScalar(const float* depth, float* sum, float* count, size_t begin, size_t end) {
+	for (size_t i = begin; i < end; i++) {
+		const float d = depth[i];
+		if (d > 0.0f) {
+			sum[i] += d;
+			count[i] += 1.0f;
+		}
+	}
+}
+
+static void segmentForegroundScalar(const float* depth, const float* background, float tolerance, uint8_t* mask, size_t begin, size_t end) {
+	for (size_t i = begin; i < end; i++) {
+		const float d = depth[i];
+		const float b = background[i];
+		mask[i] = d > 0.0f && (!(b > 0.0f) || d < b - tolerance) ? 255 : 0;
+	}
+}
+
+#ifdef KV2_X86
+KV2_TARGET("ssse3")
+static void accumulateBackgroundSSSE3(const float* depth, float* sum, float* count, size_t numPixels) {
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	size_t i = 0;
+	for (; i + 4 <= numPixels; i += 4) {
+		__m128 d = _mm_loadu_ps(depth + i);
+		__m128 valid = _mm_cmpgt_ps(d, zero);
+		_mm_storeu_ps(sum + i, _mm_add_ps(_mm_loadu_ps(sum + i), _mm_and_ps(valid, d)));
+		_mm_storeu_ps(count + i, _mm_add_ps(_mm_loadu_ps(count + i), _mm_and_ps(valid, one)));
+	}
+	accumulateBackgroundScalar(depth, sum, count, i, numPixels);
+}
+
+KV2_TARGET("avx2")
+static void accumulateBackgroundAVX2(const float* depth, float* sum, float* count, size_t numPixels) {
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	size_t i = 0;
+	for (; i + 8 <= numPixels; i += 8) {
+		__m256 d = _mm256_loadu_ps(depth + i);
+		__m256 valid = _mm256_cmp_ps(d, zero, _CMP_GT_OQ);
+		_mm256_storeu_ps(sum + i, _mm256_add_ps(_mm256_loadu_ps(sum + i), _mm256_and_ps(valid, d)));
+		_mm256_storeu_ps(count + i, _mm256_add_ps(_mm256_loadu_ps(count + i), _mm256_and_ps(valid, one)));
+	}
+	accumulateBackgroundScalar(depth, sum, count, i, numPixels);
+}
+
+KV2_TARGET("ssse3")
+static inline __m128i foregroundSSSE3(const float* depth, const float* background, __m128 tolerance) {
+	const __m128 zero = _mm_setzero_ps();
+	__m128 d = _mm_loadu_ps(depth);
+	__m128 b = _mm_loadu_ps(background);
+	__m128 closer = _mm_or_ps(_mm_cmpngt_ps(b, zero), _mm_cmplt_ps(d, _mm_sub_ps(b, tolerance)));
+	return _mm_castps_si128(_mm_and_ps(_mm_cmpgt_ps(d, zero), closer));
+}
+
+KV2_TARGET("ssse3")
+static void segmentForegroundSSSE3(const float* depth, const float* background, float tolerance, uint8_t* mask, size_t numPixels) {
+	const __m128 t = _mm_set1_ps(tolerance);
+	size_t i = 0;
+	for (; i + 16 <= numPixels; i += 16) {
+		// all ones lanes saturate to 0xFF bytes
+		__m128i a = _mm_packs_epi32(foregroundSSSE3(depth + i, background + i, t), foregroundSSSE3(depth + i + 4, background + i + 4, t));
+		__m128i b = _mm_packs_epi32(foregroundSSSE3(depth + i + 8, background + i + 8, t), foregroundSSSE3(depth + i + 12, background + i + 12, t));
+		_mm_storeu_si128((__m128i*)(mask + i), _mm_packs_epi16(a, b));
+	}
+	segmentForegroundScalar(depth, background, tolerance, mask, i, numPixels);
+}
+
+KV2_TARGET("avx2")
+static inline __m256i foregroundAVX2(const float* depth, const float* background, __m256 tolerance) {
+	const __m256 zero = _mm256_setzero_ps();
+	__m256 d = _mm256_loadu_ps(depth);
+	__m256 b = _mm256_loadu_ps(background);
+	__m256 closer = _mm256_or_ps(_mm256_cmp_ps(b, zero, _CMP_NGT_UQ), _mm256_cmp_ps(d, _mm256_sub_ps(b, tolerance), _CMP_LT_OQ));
+	return _mm256_castps_si256(_mm256_and_ps(_mm256_cmp_ps(d, zero, _CMP_GT_OQ), closer));
+}
+
+KV2_TARGET("avx2")
+static void segmentForegroundAVX2(const float* depth, const float* background, float tolerance, uint8_t* mask, size_t numPixels) {
+	const __m256 t = _mm256_set1_ps(tolerance);
+	// the packs work per 128 bit lane, this puts the 4 byte groups back in pixel order
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	size_t i = 0;
+	for (; i + 32 <= numPixels; i += 32) {
+		__m256i a = _mm256_packs_epi32(foregroundAVX2(depth + i, background + i, t), foregroundAVX2(depth + i + 8, background + i + 8, t));
+		__m256i b = _mm256_packs_epi32(foregroundAVX2(depth + i + 16, background + i + 16, t), foregroundAVX2(depth + i + 24, background + i + 24, t));
+		_mm256_storeu_si256((__m256i*)(mask + i), _mm256_permutevar8x32_epi32(_mm256_packs_epi16(a, b), order));
+	}
+	segmentForegroundScalar(depth, background, tolerance, mask, i, numPixels);
+}
+#endif
+
+//--------------------------------------------------------------------------------
+void accumulateBackground(const float* depth, float* sum, float* count, size_t numPixels) {
+#ifdef KV2_X86
+	switch (getSimdLevel()) {
+	case SIMD_AVX2: accumulateBackgroundAVX2(depth, sum, count, numPixels); return;
+	case SIMD_SSSE3: accumulateBackgroundSSSE3(depth, sum, count, numPixels); return;
+	default: break;
+	}
+#endif
+	accumulateBackgroundScalar(depth, sum, count, 0, numPixels);
+}
+
+//--------------------------------------------------------------------------------
+void finishBackground(const float* sum, const float* count, float* background, size_t numPixels) {
+	for (size_t i = 0; i < numPixels; i++) {
+		background[i] = count[i] > 0.0f ? sum[i] / count[i] : 0.0f;
+	}
+}
+
+//--------------------------------------------------------------------------------
+void segmentForeground(const float* depth, const float* background, float tolerance, uint8_t* mask, size_t numPixels) {
+#ifdef KV2_X86
+	switch (getSimdLevel()) {
+	case SIMD_AVX2: segmentForegroundAVX2(depth, background, tolerance, mask, numPixels); return;
+	case SIMD_SSSE3: segmentForegroundSSSE3(depth, background, tolerance, mask, numPixels); return;
+	default: break;
+	}
+#endif
+	segmentForegroundScalar(depth, background, tolerance, mask, 0, numPixels);
+}
+
+//--------------------------------------------------------------------------------
+// depth -> color lut
+//--------------------------------------------------------------------------------
+static void colorizeDepthScalar(const float* depth, uint8_t* rgb, size_t numPixels, const uint32_t* lut, size_t lutSize) {
+	const float size = (float)lutSize;
+	for (size_t i = 0; i < numPixels; i++, rgb += 3) {
+		float d = depth[i];
+		uint32_t c = lut[(d > 0.0f && d < size) ? (size_t)d : 0];
+		rgb[0] = c & 0xFF;
+		rgb[1] = (c >> 8) & 0xFF;
+		rgb[2] = (c >> 16) & 0xFF;
+	}
+}
+
+#ifdef KV2_X86
+KV2_TARGET("avx2")
+static void colorizeDepthAVX2(const float* depth, uint8_t* rgb, size_t numPixels, const uint32_t* lut, size_t lutSize) {
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 size = _mm256_set1_ps((float)lutSize);
+	// RGBX RGBX RGBX RGBX -> RGBRGBRGBRGB in each lane
+	const __m256i pack = _mm256_setr_epi8(
+		0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+		0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	size_t i = 0;
+	// each store writes 4 bytes past its 12, stop early enough that the next iteration or the tail overwrites them
+	for (; i + 16 <= numPixels; i += 8, rgb += 24) {
+		__m256 d = _mm256_loadu_ps(depth + i);
+		__m256 valid = _mm256_and_ps(_mm256_cmp_ps(d, zero, _CMP_GT_OQ), _mm256_cmp_ps(d, size, _CMP_LT_OQ));
+		__m256i index = _mm256_and_si256(_mm256_cvttps_epi32(d), _mm256_castps_si256(valid));
+		__m256i c = _mm256_shuffle_epi8(_mm256_i32gather_epi32((const int*)lut, index, 4), pack);
+		_mm_storeu_si128((__m128i*)rgb, _mm256_castsi256_si128(c));
+		_mm_storeu_si128((__m128i*)(rgb + 12), _mm256_extracti128_si256(c, 1));
+	}
+	colorizeDepthScalar(depth + i, rgb, numPixels - i, lut, lutSize);
+}
+#endif
+
+//--------------------------------------------------------------------------------
+void colorizeDepth(const float* depth, uint8_t* rgb, size_t numPixels, const uint32_t* lut, size_t lutSize) {
+#ifdef KV2_X86
+	if (getSimdLevel() == SIMD_AVX2) {
+		colorizeDepthAVX2(depth, rgb, numPixels, lut, lutSize);
+		return;
+	}
+#endif
+	colorizeDepthScalar(depth, rgb, numPixels, lut, lutSize);
+}
+
+//--------------------------------------------------------------------------------
+// point cloud
+//--------------------------------------------------------------------------------
+void buildRayTable(float f, float c, size_t count, float* rays) {
+	for (size_t i = 0; i < count; i++) {
+		rays[i] = (i + 0.5f - c) / f * 0.001f;
+	}
+}
+
+static void computePointCloudScalar(const float* depth, const uint32_t* bgrx, const float* rayX, const float* rayY,
+	size_t width, size_t rowBegin, size_t rowEnd, size_t colBegin, float* xyzw, float* rgba, const uint8_t* mask)
+{
+	const float bad = std::numeric_limits<float>::quiet_NaN();
+	for (size_t y = rowBegin; y < rowEnd; y++) {
+		const float ry = rayY[y];
+		for (size_t x = colBegin; x < width; x++) {
+			const size_t i = y * width + x;
+			float* pt = xyzw + i * 4;
+			const float d = depth[i];
+			// same rejection as Registration::getPointXYZ, depth <= 1mm or NaN, and whatever the mask leaves out
+			if (!(d > 1.0f) || (mask && !mask[i])) {
+				pt[0] = pt[1] = pt[2] = bad;
+				pt[3] = 1.0f;
+				if (rgba) {
+					float* col = rgba + i * 4;
+					col[0] = col[1] = col[2] = 0.0f;
+					col[3] = 1.0f;
+				}
+				continue;
+			}
+			pt[0] = rayX[x] * d;
+			pt[1] = ry * d;
+			pt[2] = d * -0.001f;
+			pt[3] = 1.0f;
+			if (!rgba) continue;
+			float* col = rgba + i * 4;
+			const uint32_t c = bgrx[i];
+			col[0] = ((c >> 16) & 0xFF) / 255.0f;
+			col[1] = ((c >> 8) & 0xFF) / 255.0f;
+			col[2] = (c & 0xFF) / 255.0f;
+			col[3] = 1.0f;
+		}
+	}
+}
+
+#ifdef KV2_X86
+// all ones lanes where the 4 or 8 mask bytes are non zero
+KV2_TARGET("ssse3")
+static inline __m128 loadMaskSSSE3(const uint8_t* mask) {
+	int32_t bits;
+	memcpy(&bits, mask, 4);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i m = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bits), zero), zero);
+	return _mm_castsi128_ps(_mm_cmpgt_epi32(m, zero));
+}
+
+KV2_TARGET("avx2")
+static inline __m256 loadMaskAVX2(const uint8_t* mask) {
+	__m256i m = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)mask));
+	return _mm256_castsi256_ps(_mm256_cmpgt_epi32(m, _mm256_setzero_si256()));
+}
+
+KV2_TARGET("ssse3")
+static void computePointCloudSSSE3(const float* depth, const uint32_t* bgrx, const float* rayX, const float* rayY,
+	size_t width, size_t rowBegin, size_t rowEnd, float* xyzw, float* rgba, const uint8_t* mask)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 toMetres = _mm_set1_ps(-0.001f);
+	const __m128 nan = _mm_set1_ps(std::numeric_limits<float>::quiet_NaN());
+	const __m128 norm = _mm_set1_ps(255.0f);
+	const __m128i byteMask = _mm_set1_epi32(0xFF);
+	const size_t vecWidth = width & ~(size_t)3;
+	for (size_t y = rowBegin; y < rowEnd; y++) {
+		const __m128 ry = _mm_set1_ps(rayY[y]);
+		for (size_t x = 0; x < vecWidth; x += 4) {
+			const size_t i = y * width + x;
+			__m128 d = _mm_loadu_ps(depth + i);
+			__m128 valid = _mm_cmpgt_ps(d, one);
+			if (mask) valid = _mm_and_ps(valid, loadMaskSSSE3(mask + i));
+			__m128 px = _mm_or_ps(_mm_and_ps(valid, _mm_mul_ps(_mm_loadu_ps(rayX + x), d)), _mm_andnot_ps(valid, nan));
+			__m128 py = _mm_or_ps(_mm_and_ps(valid, _mm_mul_ps(ry, d)), _mm_andnot_ps(valid, nan));
+			__m128 pz = _mm_or_ps(_mm_and_ps(valid, _mm_mul_ps(d, toMetres)), _mm_andnot_ps(valid, nan));
+			__m128 pw = one;
+			_MM_TRANSPOSE4_PS(px, py, pz, pw);
+			_mm_storeu_ps(xyzw + i * 4, px);
+			_mm_storeu_ps(xyzw + i * 4 + 4, py);
+			_mm_storeu_ps(xyzw + i * 4 + 8, pz);
+			_mm_storeu_ps(xyzw + i * 4 + 12, pw);
+			if (!rgba) continue;
+
+			__m128i c = _mm_and_si128(_mm_loadu_si128((const __m128i*)(bgrx + i)), _mm_castps_si128(valid));
+			__m128 r = _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(c, 16), byteMask)), norm);
+			__m128 g = _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(c, 8), byteMask)), norm);
+			__m128 b = _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(c, byteMask)), norm);
+			__m128 a = one;
+			_MM_TRANSPOSE4_PS(r, g, b, a);
+			_mm_storeu_ps(rgba + i * 4, r);
+			_mm_storeu_ps(rgba + i * 4 + 4, g);
+			_mm_storeu_ps(rgba + i * 4 + 8, b);
+			_mm_storeu_ps(rgba + i * 4 + 12, a);
+		}
+		computePointCloudScalar(depth, bgrx, rayX, rayY, width, y, y + 1, vecWidth, xyzw, rgba, mask);
+	}
+}
+
+// interleave 8 x/y/z/w into 8 consecutive xyzw
+KV2_TARGET("avx2")
+static inline void storeInterleaved(float* dst, __m256 x, __m256 y, __m256 z, __m256 w) {
+	__m256 t0 = _mm256_unpacklo_ps(x, y);
+	__m256 t1 = _mm256_unpackhi_ps(x, y);
+	__m256 t2 = _mm256_unpacklo_ps(z, w);
+	__m256 t3 = _mm256_unpackhi_ps(z, w);
+	__m256 p0 = _mm256_shuffle_ps(t0, t2, 0x44);
+	__m256 p1 = _mm256_shuffle_ps(t0, t2, 0xEE);
+	__m256 p2 = _mm256_shuffle_ps(t1, t3, 0x44);
+	__m256 p3 = _mm256_shuffle_ps(t1, t3, 0xEE);
+	_mm256_storeu_ps(dst, _mm256_permute2f128_ps(p0, p1, 0x20));
+	_mm256_storeu_ps(dst + 8, _mm256_permute2f128_ps(p2, p3, 0x20));
+	_mm256_storeu_ps(dst + 16, _mm256_permute2f128_ps(p0, p1, 0x31));
+	_mm256_storeu_ps(dst + 24, _mm256_permute2f128_ps(p2, p3, 0x31));
+}
+
+KV2_TARGET("avx2")
+static void computePointCloudAVX2(const float* depth, const uint32_t* bgrx, const float* rayX, const float* rayY,
+	size_t width, size_t rowBegin, size_t rowEnd, float* xyzw, float* rgba, const uint8_t* mask)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 toMetres = _mm256_set1_ps(-0.001f);
+	const __m256 nan = _mm256_set1_ps(std::numeric_limits<float>::quiet_NaN());
+	const __m256 norm = _mm256_set1_ps(255.0f);
+	const __m256i byteMask = _mm256_set1_epi32(0xFF);
+	const size_t vecWidth = width & ~(size_t)7;
+	for (size_t y = rowBegin; y < rowEnd; y++) {
+		const __m256 ry = _mm256_set1_ps(rayY[y]);
+		for (size_t x = 0; x < vecWidth; x += 8) {
+			const size_t i = y * width + x;
+			__m256 d = _mm256_loadu_ps(depth + i);
+			__m256 valid = _mm256_cmp_ps(d, one, _CMP_GT_OQ);
+			if (mask) valid = _mm256_and_ps(valid, loadMaskAVX2(mask + i));
+			__m256 px = _mm256_blendv_ps(nan, _mm256_mul_ps(_mm256_loadu_ps(rayX + x), d), valid);
+			__m256 py = _mm256_blendv_ps(nan, _mm256_mul_ps(ry, d), valid);
+			__m256 pz = _mm256_blendv_ps(nan, _mm256_mul_ps(d, toMetres), valid);
+			storeInterleaved(xyzw + i * 4, px, py, pz, one);
+			if (!rgba) continue;
+
+			__m256i c = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(bgrx + i)), _mm256_castps_si256(valid));
+			__m256 r = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(c, 16), byteMask)), norm);
+			__m256 g = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(c, 8), byteMask)), norm);
+			__m256 b = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_and_si256(c, byteMask)), norm);
+			storeInterleaved(rgba + i * 4, r, g, b, one);
+		}
+		computePointCloudScalar(depth, bgrx, rayX, rayY, width, y, y + 1, vecWidth, xyzw, rgba, mask);
+	}
+}
+#endif
+
+//--------------------------------------------------------------------------------
+void computePointCloud(const float* depth, const uint32_t* bgrx, const float* rayX, const float* rayY,
+	size_t width, size_t rowBegin, size_t rowEnd, float* xyzw, float* rgba, const uint8_t* mask)
+{
+#ifdef KV2_X86
+	switch (getSimdLevel()) {
+	case SIMD_AVX2: computePointCloudAVX2(depth, bgrx, rayX, rayY, width, rowBegin, rowEnd, xyzw, rgba, mask); return;
+	case SIMD_SSSE3: computePointCloudSSSE3(depth, bgrx, rayX, rayY, width, rowBegin, rowEnd, xyzw, rgba, mask); return;
+	default: break;
+	}
+#endif
+	computePointCloudScalar(depth, bgrx, rayX, rayY, width, rowBegin, rowEnd, 0, xyzw, rgba, mask);
+}
+
+//--------------------------------------------------------------------------------
+uint16_t floatToHalf(float value) {
+	const uint32_t f32Infinity = 255u << 23;
+	const uint32_t f16Max = (127u + 16) << 23;
+	const uint32_t denormMagic = ((127u - 15) + (23 - 10) + 1) << 23;
+
+	uint32_t f;
+	memcpy(&f, &value, 4);
+	const uint32_t sign = f & 0x80000000u;
+	f ^= sign;
+
+	uint16_t half;
+	if (f >= f16Max) {
+		// overflow to infinity, NaN stays a quiet NaN
+		half = f > f32Infinity ? 0x7E00 : 0x7C00;
+	}
+	else if (f < (113u << 23)) {
+		// denormal, let the fpu do the rounding
+		float magic, v;
+		memcpy(&magic, &denormMagic, 4);
+		memcpy(&v, &f, 4);
+		v += magic;
+		memcpy(&f, &v, 4);
+		half = (uint16_t)(f - denormMagic);
+	}
+	else {
+		const uint32_t mantissaOdd = (f >> 13) & 1;
+		f += ((uint32_t)(15 - 127) << 23) + 0xFFF;
+		f += mantissaOdd;
+		half = (uint16_t)(f >> 13);
+	}
+	return half | (uint16_t)(sign >> 16);
+}
+
+float halfToFloat(uint16_t value) {
+	const uint32_t shiftedExponent = 0x7C00u << 13;
+	const uint32_t magicBits = 113u << 23;
+
+	uint32_t f = (value & 0x7FFFu) << 13;
+	const uint32_t exponent = f & shiftedExponent;
+	f += (127u - 15) << 23;
+	if (exponent == shiftedExponent) {
+		// infinity or NaN
+		f += (128u - 16) << 23;
+	}
+	else if (exponent == 0) {
+		// denormal, renormalize
+		f += 1u << 23;
+		float magic, v;
+		memcpy(&magic, &magicBits, 4);
+		memcpy(&v, &f, 4);
+		v -= magic;
+		memcpy(&f, &v, 4);
+	}
+	f |= (uint32_t)(value & 0x8000u) << 16;
+
+	float result;
+	memcpy(&result, &f, 4);
+	return result;
+}
+
+static void computePointCloudPackedScalar(const float* depth, const uint32_t* bgrx, const float* rayX, const float* rayY,
+	size_t width, size_t rowBegin, size_t rowEnd, size_t colBegin, uint16_t* xyzwHalf, uint32_t* rgba8, const uint8_t* mask)
+{
+	const uint16_t bad = 0x7E00;
+	const uint16_t one = 0x3C00;
+	for (size_t y = rowBegin; y < rowEnd; y++) {
+		const float ry = rayY[y];
+		for (size_t x = colBegin; x < width; x++) {
+			const size_t i = y * width + x;
+			uint16_t* pt = xyzwHalf + i * 4;
+			const float d = depth[i];
+			if (!(d > 1.0f) || (mask && !mask[i])) {
+				pt[0] = pt[1] = pt[2] = bad;
+				pt[3] = one;
+				if (rgba8) rgba8[i] = 0xFF000000u;
+				continue;
+			}
+			pt[0] = floatToHalf(rayX[x] * d);
+			pt[1] = floatToHalf(ry * d);
+			pt[2] = floatToHalf(d * -0.001f);
+			pt[3] = one;
+			if (!rgba8) continue;
+			const uint32_t c = bgrx[i];
+			rgba8[i] = ((c >> 16) & 0xFF) | (c & 0xFF00) | ((c & 0xFF) << 16) | 0xFF000000u;
+		}
+	}
+}
+
+static void unpackPointCloudScalar(const uint16_t* xyzwHalf, const uint32_t* rgba8, size_t begin, size_t numPoints, float* xyzw, float* rgba)
+{
+	for (size_t i = begin; i < numPoints; i++) {
+		if (xyzw) {
+			for (int k = 0; k < 4; k++) xyzw[i * 4 + k] = halfToFloat(xyzwHalf[i * 4 + k]);
+		}
+		if (rgba) {
+			const uint32_t c = rgba8[i];
+			rgba[i * 4 + 0] = (c & 0xFF) / 255.0f;
+			rgba[i * 4 + 1] = ((c >> 8) & 0xFF) / 255.0f;
+			rgba[i * 4 + 2] = ((c >> 16) & 0xFF) / 255.0f;
+			rgba[i * 4 + 3] = (c >> 24) / 255.0f;
+		}
+	}
+}
+
+#ifdef KV2_X86
+KV2_TARGET("avx2,f16c")
+static void computePointCloudPackedAVX2(const float* depth, const uint32_t* bgrx, const float* rayX, const float* rayY,
+	size_t width, size_t rowBegin, size_t rowEnd, uint16_t* xyzwHalf, uint32_t* rgba8, const uint8_t* mask)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 toMetres = _mm256_set1_ps(-0.001f);
+	const __m256 nan = _mm256_set1_ps(std::numeric_limits<float>::quiet_NaN());
+	const __m128i halfOne = _mm_set1_epi16(0x3C00);
+	const __m256i alpha = _mm256_set1_epi32((int)0xFF000000u);
+	// BGRX -> RGB_ per pixel, alpha is or'ed in afterwards
+	const __m256i swizzle = _mm256_setr_epi8(2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1,
+		2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1);
+	const size_t vecWidth = width & ~(size_t)7;
+	for (size_t y = rowBegin; y < rowEnd; y++) {
+		const __m256 ry = _mm256_set1_ps(rayY[y]);
+		for (size_t x = 0; x < vecWidth; x += 8) {
+			const size_t i = y * width + x;
+			__m256 d = _mm256_loadu_ps(depth + i);
+			__m256 valid = _mm256_cmp_ps(d, one, _CMP_GT_OQ);
+			if (mask) valid = _mm256_and_ps(valid, loadMaskAVX2(mask + i));
+			__m128i hx = _mm256_cvtps_ph(_mm256_blendv_ps(nan, _mm256_mul_ps(_mm256_loadu_ps(rayX + x), d), valid), _MM_FROUND_TO_NEAREST_INT);
+			__m128i hy = _mm256_cvtps_ph(_mm256_blendv_ps(nan, _mm256_mul_ps(ry, d), valid), _MM_FROUND_TO_NEAREST_INT);
+			__m128i hz = _mm256_cvtps_ph(_mm256_blendv_ps(nan, _mm256_mul_ps(d, toMetres), valid), _MM_FROUND_TO_NEAREST_INT);
+
+			// interleave to xyzw per point
+			__m128i xyLo = _mm_unpacklo_epi16(hx, hy);
+			__m128i xyHi = _mm_unpackhi_epi16(hx, hy);
+			__m128i zwLo = _mm_unpacklo_epi16(hz, halfOne);
+			__m128i zwHi = _mm_unpackhi_epi16(hz, halfOne);
+			__m128i* dst = (__m128i*)(xyzwHalf + i * 4);
+			_mm_storeu_si128(dst + 0, _mm_unpacklo_epi32(xyLo, zwLo));
+			_mm_storeu_si128(dst + 1, _mm_unpackhi_epi32(xyLo, zwLo));
+			_mm_storeu_si128(dst + 2, _mm_unpacklo_epi32(xyHi, zwHi));
+			_mm_storeu_si128(dst + 3, _mm_unpackhi_epi32(xyHi, zwHi));
+			if (!rgba8) continue;
+
+			__m256i c = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(bgrx + i)), _mm256_castps_si256(valid));
+			c = _mm256_or_si256(_mm256_shuffle_epi8(c, swizzle), alpha);
+			_mm256_storeu_si256((__m256i*)(rgba8 + i), c);
+		}
+		computePointCloudPackedScalar(depth, bgrx, rayX, rayY, width, y, y + 1, vecWidth, xyzwHalf, rgba8, mask);
+	}
+}
+
+KV2_TARGET("avx2,f16c")
+static void unpackPointCloudAVX2(const uint16_t* xyzwHalf, const uint32_t* rgba8, size_t numPoints, float* xyzw, float* rgba)
+{
+	// two points per conversion for the vertices, one per widening for the colors
+	const size_t vecPoints = numPoints & ~(size_t)1;
+	const __m128 norm = _mm_set1_ps(255.0f);
+	for (size_t i = 0; i < vecPoints; i += 2) {
+		if (xyzw) {
+			__m128i h = _mm_loadu_si128((const __m128i*)(xyzwHalf + i * 4));
+			_mm256_storeu_ps(xyzw + i * 4, _mm256_cvtph_ps(h));
+		}
+		if (rgba) {
+			__m128i c0 = _mm_cvtepu8_epi32(_mm_cvtsi32_si128((int)rgba8[i]));
+			__m128i c1 = _mm_cvtepu8_epi32(_mm_cvtsi32_si128((int)rgba8[i + 1]));
+			_mm_storeu_ps(rgba + i * 4, _mm_div_ps(_mm_cvtepi32_ps(c0), norm));
+			_mm_storeu_ps(rgba + i * 4 + 4, _mm_div_ps(_mm_cvtepi32_ps(c1), norm));
+		}
+	}
+	unpackPointCloudScalar(xyzwHalf, rgba8, vecPoints, numPoints, xyzw, rgba);
+}
+#endif
+
+//--------------------------------------------------------------------------------
+void computePointCloudPacked(const float* depth, const uint32_t* bgrx, const float* rayX, const float* rayY,
+	size_t width, size_t rowBegin, size_t rowEnd, uint16_t* xyzwHalf, uint32_t* rgba8, const uint8_t* mask)
+{
+#ifdef KV2_X86
+	if (getSimdLevel() == SIMD_AVX2) {
+		computePointCloudPackedAVX2(depth, bgrx, rayX, rayY, width, rowBegin, rowEnd, xyzwHalf, rgba8, mask);
+		return;
+	}
+#endif
+	computePointCloudPackedScalar(depth, bgrx, rayX, rayY, width, rowBegin, rowEnd, 0, xyzwHalf, rgba8, mask);
+}
+
+//--------------------------------------------------------------------------------
+void unpackPointCloud(const uint16_t* xyzwHalf, const uint32_t* rgba8, size_t numPoints, float* xyzw, float* rgba)
+{
+#ifdef KV2_X86
+	if (getSimdLevel() == SIMD_AVX2) {
+		unpackPointCloudAVX2(xyzwHalf, rgba8, numPoints, xyzw, rgba);
+		return;
+	}
+#endif
+	unpackPointCloudScalar(xyzwHalf, rgba8, 0, numPoints, xyzw, rgba);
+}
+
+//--------------------------------------------------------------------------------
+// triangles of the cell whose bottom right corner is (x, y)
+static inline uint32_t* triangulateCell(const float* depth, const uint8_t* user, size_t width, size_t x, size_t y,
+	float maxNear, uint32_t* out)
+{
+	const float* row = depth + y * width;
+	const float* rowTop = row - width;
+
+	// corners of the cell, masked like the shader does
+	float d = row[x];
+	float dTopLeft = rowTop[x - 1];
+	float dTop = rowTop[x];
+	float dLeft = row[x - 1];
+	if (user) {
+		const uint8_t* userRow = user + y * width;
+		const uint8_t* userTop = userRow - width;
+		if (!userRow[x]) d = 0.0f;
+		if (!userTop[x - 1]) dTopLeft = 0.0f;
+		if (!userTop[x]) dTop = 0.0f;
+		if (!userRow[x - 1]) dLeft = 0.0f;
+	}
+
+	const uint32_t index = (uint32_t)(y * width + x);
+	const uint32_t indexTopLeft = index - (uint32_t)width - 1;
+	const uint32_t indexTop = index - (uint32_t)width;
+	const uint32_t indexLeft = index - 1;
+
+	const bool hasTopEdge = maxNear > std::fabs(dTopLeft - dTop);
+	const bool hasLeftEdge = maxNear > std::fabs(dTopLeft - dLeft);
+	const bool hasRightEdge = maxNear > std::fabs(dTop - d);
+	const bool hasBottomEdge = maxNear > std::fabs(dLeft - d);
+
+	// split along the top left to bottom right diagonal first
+	bool bSplit = false;
+	if (dTopLeft != 0.0f && d != 0.0f) {
+		if (hasTopEdge && hasRightEdge && dTop != 0.0f) {
+			out[0] = index; out[1] = indexTop; out[2] = indexTopLeft;
+			out += 3;
+			bSplit = true;
+		}
+		if (hasLeftEdge && hasBottomEdge && dLeft != 0.0f) {
+			out[0] = index; out[1] = indexTopLeft; out[2] = indexLeft;
+			out += 3;
+			bSplit = true;
+		}
+	}
+	if (bSplit) return out;
+
+	// then along the other one
+	if (dTop != 0.0f && dLeft != 0.0f) {
+		if (hasTopEdge && hasLeftEdge && dTopLeft != 0.0f) {
+			out[0] = indexTop; out[1] = indexTopLeft; out[2] = indexLeft;
+			out += 3;
+		}
+		if (hasRightEdge && hasBottomEdge && d != 0.0f) {
+			out[0] = indexLeft; out[1] = index; out[2] = indexTop;
+			out += 3;
+		}
+	}
+	return out;
+}
+
+//--------------------------------------------------------------------------------
+size_t triangulateDepth(const float* depth, const uint8_t* user, size_t width, size_t rowBegin, size_t rowEnd,
+	float maxNear, uint32_t* indices)
+{
+	uint32_t* out = indices;
+	if (rowBegin < 1) rowBegin = 1;
+	for (size_t y = rowBegin; y < rowEnd; y++) {
+		for (size_t x = 1; x < width; x++) {
+			out = triangulateCell(depth, user, width, x, y, maxNear, out);
+		}
+	}
+	return out - indices;
+}
+
+//--------------------------------------------------------------------------------
+// true if every pixel of the block at (x0, y0) is valid and within tolerance of the two triangles through its corners
+static bool isBlockPlanar(const float* depth, size_t width, size_t x0, size_t y0, size_t size, float tolerance)
+{
+	const float* top = depth + y0 * width + x0;
+	const float* bottom = top + size * width;
+	const float dTopLeft = top[0];
+	const float dTopRight = top[size];
+	const float dBottomLeft = bottom[0];
+	const float dBottomRight = bottom[size];
+	if (!(dTopLeft > 0.0f && dTopRight > 0.0f && dBottomLeft > 0.0f && dBottomRight > 0.0f))
+		return false;
+
+	// depth through a plane is not linear in the pixel coordinates but its inverse is
+	const float iTopLeft = 1.0f / dTopLeft;
+	const float iTopRight = 1.0f / dTopRight;
+	const float iBottomLeft = 1.0f / dBottomLeft;
+	const float iBottomRight = 1.0f / dBottomRight;
+	const float step = 1.0f / size;
+	for (size_t v = 0; v <= size; v++) {
+		const float* row = top + v * width;
+		const float fv = v * step;
+		for (size_t u = 0; u <= size; u++) {
+			const float d = row[u];
+			if (!(d > 0.0f))
+				return false;
+			const float fu = u * step;
+			const float inv = fu >= fv
+				? iTopLeft + fu * (iTopRight - iTopLeft) + fv * (iBottomRight - iTopRight)
+				: iTopLeft + fv * (iBottomLeft - iTopLeft) + fu * (iBottomRight - iBottomLeft);
+			if (std::fabs(d - 1.0f / inv) > tolerance)
+				return false;
+		}
+	}
+	return true;
+}
+
+//--------------------------------------------------------------------------------
+// quadtree over the cells of the block with top left vertex (x0, y0)
+static uint32_t* triangulateBlock(const float* depth, size_t width, size_t height, size_t x0, size_t y0, size_t size,
+	float maxNear, float tolerance, uint32_t* out)
+{
+	if (x0 + 1 >= width || y0 + 1 >= height)
+		return out;
+	if (size == 1)
+		return triangulateCell(depth, nullptr, width, x0 + 1, y0 + 1, maxNear, out);
+
+	if (x0 + size < width && y0 + size < height && isBlockPlanar(depth, width, x0, y0, size, tolerance)) {
+		// same diagonal and winding as the first split of a single cell
+		const uint32_t indexTopLeft = (uint32_t)(y0 * width + x0);
+		const uint32_t indexTopRight = indexTopLeft + (uint32_t)size;
+		const uint32_t indexBottomLeft = indexTopLeft + (uint32_t)(size * width);
+		const uint32_t indexBottomRight = indexBottomLeft + (uint32_t)size;
+		out[0] = indexBottomRight; out[1] = indexTopRight; out[2] = indexTopLeft;
+		out[3] = indexBottomRight; out[4] = indexTopLeft; out[5] = indexBottomLeft;
+		return out + 6;
+	}
+
+	const size_t half = size / 2;
+	out = triangulateBlock(depth, width, height, x0, y0, half, maxNear, tolerance, out);
+	out = triangulateBlock(depth, width, height, x0 + half, y0, half, maxNear, tolerance, out);
+	out = triangulateBlock(depth, width, height, x0, y0 + half, half, maxNear, tolerance, out);
+	out = triangulateBlock(depth, width, height, x0 + half, y0 + half, half, maxNear, tolerance, out);
+	return out;
+}
+
+//--------------------------------------------------------------------------------
+size_t triangulateDepthAdaptive(const float* depth, size_t width, size_t height, size_t maxBlock, float maxNear,
+	float tolerance, size_t stripBegin, size_t stripEnd, uint32_t* indices)
+{
+	uint32_t* out = indices;
+	for (size_t strip = stripBegin; strip < stripEnd; strip++) {
+		for (size_t x0 = 0; x0 + 1 < width; x0 += maxBlock) {
+			out = triangulateBlock(depth, width, height, x0, strip * maxBlock, maxBlock, maxNear, tolerance, out);
+		}
+	}
+	return out - indices;
+}
+
+//--------------------------------------------------------------------------------
+// LatencyHistogram
+
+LatencyHistogram::LatencyHistogram() {
+	reset();
+}
+
+void LatencyHistogram::reset() {
+	for (auto& bucket : buckets) bucket.store(0, std::memory_order_relaxed);
+	count.store(0, std::memory_order_relaxed);
+	maxValue.store(0, std::memory_order_relaxed);
+}
+
+// 0-15 get a bucket each, above that four buckets per power of two
+int LatencyHistogram::getBucket(uint64_t micros) {
+	if (micros < 16) return (int)micros;
+	int exponent = 63;
+	while (!(micros >> exponent)) exponent--;
+	int bucket = 16 + (exponent - 4) * 4 + (int)((micros >> (exponent - 2)) & 3);
+	return bucket < NUM_BUCKETS ? bucket : NUM_BUCKETS - 1;
+}
+
+uint64_t LatencyHistogram::getBucketMax(int bucket) {
+	if (bucket < 16) return bucket;
+	int exponent = (bucket - 16) / 4 + 4;
+	uint64_t sub = (bucket - 16) % 4;
+	return ((uint64_t(4) + sub + 1) << (exponent - 2)) - 1;
+}
+
+void LatencyHistogram::record(uint64_t micros) {
+	buckets[getBucket(micros)].fetch_add(1, std::memory_order_relaxed);
+	count.fetch_add(1, std::memory_order_relaxed);
+	uint64_t previous = maxValue.load(std::memory_order_relaxed);
+	while (micros > previous && !maxValue.compare_exchange_weak(previous, micros, std::memory_order_relaxed)) {}
+}
+
+uint64_t LatencyHistogram::getPercentile(double fraction) const {
+	uint64_t total = 0;
+	uint64_t counts[NUM_BUCKETS];
+	for (int i = 0; i < NUM_BUCKETS; i++) {
+		counts[i] = buckets[i].load(std::memory_order_relaxed);
+		total += counts[i];
+	}
+	if (!total) return 0;
+
+	const uint64_t rank = (uint64_t)(fraction * (total - 1)) + 1;
+	uint64_t seen = 0;
+	for (int i = 0; i < NUM_BUCKETS; i++) {
+		seen += counts[i];
+		if (seen >= rank) return std::min(getBucketMax(i), getMax());
+	}
+	return getMax();
+}
+
+//--------------------------------------------------------------------------------
+// ThreadPool
+//--------------------------------------------------------------------------------
+ThreadPool::ThreadPool(int numThreads) : jobNext(0) {
+	if (numThreads <= 0) numThreads = (int)std::thread::hardware_concurrency();
+	for (int i = 1; i < numThreads; i++) {
+		workers.emplace_back(&ThreadPool::work, this);
+	}
+}
+
+//--------------------------------------------------------------------------------
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		bQuit = true;
+	}
+	startCondition.notify_all();
+	for (auto& t : workers) t.join();
+}
+
+//--------------------------------------------------------------------------------
+bool ThreadPool::runChunk() {
+	size_t begin = jobNext.fetch_add(jobChunk);
+	if (begin >= jobCount) return false;
+	size_t end = begin + jobChunk < jobCount ? begin + jobChunk : jobCount;
+	(*job)(begin, end);
+	return true;
+}
+
+//--------------------------------------------------------------------------------
+void ThreadPool::work() {
+	uint64_t seen = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			startCondition.wait(lock, [&] { return bQuit || generation != seen; });
+			if (bQuit) return;
+			seen = generation;
+		}
+		while (runChunk()) {}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busy--;
+		}
+		doneCondition.notify_one();
+	}
+}
+
+//--------------------------------------------------------------------------------
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t, size_t)>& fn) {
+	if (count == 0) return;
+	if (workers.empty() || count == 1) {
+		fn(0, count);
+		return;
+	}
+
+	// only one job in flight, other callers queue up here
+	std::lock_guard<std::mutex> call(callMutex);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &fn;
+		jobCount = count;
+		// a few chunks per thread so uneven rows balance out
+		size_t numChunks = (size_t)getNumThreads() * 4;
+		jobChunk = (count + numChunks - 1) / numChunks;
+		jobNext = 0;
+		busy = (int)workers.size();
+		generation++;
+	}
+	startCondition.notify_all();
+	while (runChunk()) {}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCondition.wait(lock, [&] { return busy == 0; });
+	job = nullptr;
+}
+
+}
@@ -0,0 +1,218 @@
+//
+//  ofxKinectV2Kernels.h
+//  kinectExample
+//
+//  Per-frame pixel kernels used by the ofxKinectV2 worker thread.
+//  Every kernel has a scalar reference path and, on x86, SSSE3/AVX2 paths
+//  that are picked once at runtime from the cpu features.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ofxKinectV2Kernels {
+
+	enum SimdLevel {
+		SIMD_SCALAR = 0,
+		SIMD_SSSE3,
+		SIMD_AVX2
+	};
+
+	// highest instruction set the kernels will use on this machine
+	SimdLevel getSimdLevel();
+	const char* getSimdLevelName(SimdLevel level);
+
+	// force a lower level, e.g. for benchmarking against the scalar path. clamped to what the cpu supports
+	void setSimdLevel(SimdLevel level);
+
+	// copy libfreenect2 BGRX pixels into RGBA in one pass, the 4th byte is kept as is
+	void convertBGRXToRGBA(const uint8_t* src, uint8_t* dst, size_t numPixels);
+
+	// box filter BGRX pixels down by factor (2, 4 or 8) in each direction, rows [rowBegin, rowEnd) of the small image
+	void downscaleBGRX(const uint8_t* src, size_t srcWidth, size_t factor, size_t rowBegin, size_t rowEnd, uint8_t* dst);
+
+	// dst = src * scale, used to bring the 0-65535 ir range down to 0-1 while copying
+	void copyScaled(const float* src, float* dst, size_t numPixels, float scale);
+
+	// round and clamp float samples to 0-65535
+	void convertFloatToShort(const float* src, uint16_t* dst, size_t numPixels);
+
+	// per pixel median of 3 or 5 depth frames of numPixels each, dst may be one of them. other counts copy frames[0]
+	void medianDepth(const float* const* frames, size_t numFrames, float* dst, size_t numPixels);
+
+	// exponential smoothing against per pixel state: the state keeps smoothing (0-1) of itself and takes the rest
+	// from depth, or jumps to depth when either is 0 or they are more than threshold mm apart. dst gets the new
+	// state and may be depth
+	void smoothDepth(const float* depth, float* state, float* dst, size_t numPixels, float smoothing, float threshold);
+
+	// background model: accumulate adds depth > 0 to per pixel sum and count while learning, finish turns them into
+	// the mean background (0 where nothing was seen), segment sets mask to 255 where depth is valid and more than
+	// tolerance mm in front of the background or where there is no background, 0 elsewhere
+	void accumulateBackground(const float* depth, float* sum, float* count, size_t numPixels);
+	void finishBackground(const float* sum, const float* count, float* background, size_t numPixels);
+	void segmentForeground(const float* depth, const float* background, float tolerance, uint8_t* mask, size_t numPixels);
+
+	// map millimetre depth to packed RGBX colors through lut[(int)depth], writes 3 bytes per pixel.
+	// depth outside [0, lutSize) or NaN uses lut[0]
+	void colorizeDepth(const float* depth, uint8_t* rgb, size_t numPixels, const uint32_t* lut, size_t lutSize);
+
+	// rays[i] = (i + 0.5 - c) / f in metres per millimetre of depth, so a point is one multiply away
+	void buildRayTable(float f, float c, size_t count, float* rays);
+
+	// organized point cloud for rows [rowBegin, rowEnd) of an undistorted depth frame (mm) and its registered BGRX color.
+	// writes xyzw (metres, z negated, w = 1) and rgba floats at the same pixel offsets, invalid depth gives NaN and black.
+	// rgba may be nullptr to skip the colors, bgrx is not read then. pixels with a zero mask byte count as invalid
+	void computePointCloud(const float* depth, const uint32_t* bgrx, const float* rayX, const float* rayY,
+		size_t width, size_t rowBegin, size_t rowEnd, float* xyzw, float* rgba, const uint8_t* mask = nullptr);
+
+	// same cloud packed to 12 bytes a point: xyzw as half floats and RGBA8 color with alpha 255.
+	// invalid depth gives NaN and opaque black, rgba8 may be nullptr to skip the colors
+	void computePointCloudPacked(const float* depth, const uint32_t* bgrx, const float* rayX, const float* rayY,
+		size_t width, size_t rowBegin, size_t rowEnd, uint16_t* xyzwHalf, uint32_t* rgba8, const uint8_t* mask = nullptr);
+
+	// packed points back to the float layout of computePointCloud, either output may be nullptr
+	void unpackPointCloud(const uint16_t* xyzwHalf, const uint32_t* rgba8, size_t numPoints, float* xyzw, float* rgba);
+
+	// mesh indices between neighbouring depth pixels for the cells of rows [rowBegin, rowEnd), row 0 has none.
+	// same rules as the compute shader in ofxKinectV2: corners must be non zero (and have a non zero user byte when
+	// user is given) and edges shorter than maxNear. only real triangles are written, 3 indices each, and the number of
+	// indices is returned. indices needs room for (rowEnd - rowBegin) * (width - 1) * 6
+	size_t triangulateDepth(const float* depth, const uint8_t* user, size_t width, size_t rowBegin, size_t rowEnd,
+		float maxNear, uint32_t* indices);
+
+	// mesh indices like triangulateDepth for a whole width x height frame, but square blocks of up to maxBlock cells
+	// (a power of two) whose pixels all lie within tolerance mm of the two triangles through the block corners become
+	// those two triangles. the rest is split down to single cells. neighbouring blocks of different size are not
+	// stitched, the gaps at their t junctions stay below tolerance. covers the maxBlock tall strips of cells
+	// [stripBegin, stripEnd), indices needs room for maxBlock * (width - 1) * 6 per strip
+	size_t triangulateDepthAdaptive(const float* depth, size_t width, size_t height, size_t maxBlock, float maxNear,
+		float tolerance, size_t stripBegin, size_t stripEnd, uint32_t* indices);
+
+	// ieee half conversion, round to nearest even like F16C
+	uint16_t floatToHalf(float value);
+	float halfToFloat(uint16_t value);
+
+	// small persistent pool so the per frame loops don't pay for thread creation
+	class ThreadPool {
+	public:
+		// 0 uses all hardware threads, the calling thread counts as one of them
+		ThreadPool(int numThreads = 0);
+		~ThreadPool();
+
+		int getNumThreads() const { return (int)workers.size() + 1; }
+
+		// calls fn(begin, end) on ranges covering [0, count), returns when all ranges are done
+		void parallelFor(size_t count, const std::function<void(size_t, size_t)>& fn);
+
+	private:
+		void work();
+		bool runChunk();
+
+		std::vector<std::thread> workers;
+		std::mutex callMutex;
+		std::mutex mutex;
+		std::condition_variable startCondition;
+		std::condition_variable doneCondition;
+		const std::function<void(size_t, size_t)>* job = nullptr;
+		size_t jobCount = 0;
+		size_t jobChunk = 1;
+		std::atomic<size_t> jobNext;
+		int busy = 0;
+		uint64_t generation = 0;
+		bool bQuit = false;
+	};
+
+	// lock free log scale histogram of microsecond timings, about 25% resolution, record() may race with reads
+	class LatencyHistogram {
+	public:
+		static const int NUM_BUCKETS = 128;
+
+		LatencyHistogram();
+
+		void record(uint64_t micros);
+		void reset();
+
+		uint64_t getCount() const { return count.load(std::memory_order_relaxed); }
+		uint64_t getMax() const { return maxValue.load(std::memory_order_relaxed); }
+		// upper bound of the bucket holding the given fraction (0-1) of the samples, never above getMax()
+		uint64_t getPercentile(double fraction) const;
+
+	private:
+		static int getBucket(uint64_t micros);
+		static uint64_t getBucketMax(int bucket);
+
+		std::atomic<uint64_t> buckets[NUM_BUCKETS];
+		std::atomic<uint64_t> count;
+		std::atomic<uint64_t> maxValue;
+	};
+
+	// blocking fifo between two threads with a capacity that can change while in use
+	template<class T>
+	class BoundedQueue {
+	public:
+		BoundedQueue(size_t c = 1) : capacity(c > 0 ? c : 1) {}
+
+		void setCapacity(size_t c) {
+			std::lock_guard<std::mutex> lock(mutex);
+			capacity = c > 0 ? c : 1;
+			notFull.notify_all();
+		}
+
+		size_t size() const {
+			std::lock_guard<std::mutex> lock(mutex);
+			return items.size();
+		}
+
+		// waits for room, false if the queue got closed
+		bool push(T&& item) {
+			std::unique_lock<std::mutex> lock(mutex);
+			notFull.wait(lock, [&] { return bClosed || items.size() < capacity; });
+			if (bClosed) return false;
+			items.push_back(std::move(item));
+			notEmpty.notify_one();
+			return true;
+		}
+
+		// waits for an item, false once the queue is closed and drained
+		bool pop(T& item) {
+			std::unique_lock<std::mutex> lock(mutex);
+			notEmpty.wait(lock, [&] { return bClosed || !items.empty(); });
+			if (items.empty()) return false;
+			item = std::move(items.front());
+			items.pop_front();
+			notFull.notify_one();
+			return true;
+		}
+
+		// wakes everyone, pop keeps returning what is left
+		void close() {
+			std::lock_guard<std::mutex> lock(mutex);
+			bClosed = true;
+			notFull.notify_all();
+			notEmpty.notify_all();
+		}
+
+		void reopen() {
+			std::lock_guard<std::mutex> lock(mutex);
+			items.clear();
+			bClosed = false;
+		}
+
+	private:
+		std::deque<T> items;
+		mutable std::mutex mutex;
+		std::condition_variable notFull;
+		std::condition_variable notEmpty;
+		size_t capacity;
+		bool bClosed = false;
+	};
+}
@@ -0,0 +1,349 @@
+//
+//  ofxKinectV2Registration.cpp
+//  kinectExample
+//
+
+#include "ofxKinectV2Registration.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+// scales of the depth to color polynomial, doubles like in libfreenect2
+static const double depthQ = 0.01;
+static const double colorQ = 0.002199;
+// relative depth difference to the nearest z above which a color is treated as hidden
+static const float filterTolerance = 0.01f;
+
+// table cache file: magic, version, key, both camera parameter blocks, then the per pixel tables
+static const char tableMagic[8] = { 'K', 'V', '2', 'T', 'A', 'B', 'L', 'E' };
+static const uint32_t tableVersion = 1;
+
+//--------------------------------------------------------------------------------
+ofxKinectV2Registration::ofxKinectV2Registration(const libfreenect2::Freenect2Device::IrCameraParams& depthParams,
+	const libfreenect2::Freenect2Device::ColorCameraParams& colorParams, const std::string& cachePath, const std::string& cacheKey)
+	: depthParams(depthParams), colorParams(colorParams)
+{
+	const int numPixels = DEPTH_WIDTH * DEPTH_HEIGHT;
+	distortIndex.resize(numPixels);
+	colorX.resize(numPixels);
+	colorRow.resize(numPixels);
+	colorY.resize(numPixels);
+	colorOffset.resize(numPixels);
+
+	bTablesCached = !cachePath.empty() && loadTables(cachePath, cacheKey);
+	if (!bTablesCached)
+	{
+		buildTables();
+		if (!cachePath.empty()) saveTables(cachePath, cacheKey);
+	}
+
+	setColorScale(1);
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2Registration::buildTables()
+{
+	for (int y = 0; y < DEPTH_HEIGHT; y++)
+	{
+		for (int x = 0; x < DEPTH_WIDTH; x++)
+		{
+			const int i = y * DEPTH_WIDTH + x;
+
+			float mx, my;
+			distort(x, y, mx, my);
+			int ix = (int)(mx + 0.5f);
+			int iy = (int)(my + 0.5f);
+			distortIndex[i] = ix < 0 || ix >= DEPTH_WIDTH || iy < 0 || iy >= DEPTH_HEIGHT ? -1 : iy * DEPTH_WIDTH + ix;
+
+			float rx, ry;
+			depthToColor(x, y, rx, ry);
+			colorX[i] = rx;
+			colorRow[i] = ry;
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------
+bool ofxKinectV2Registration::loadTables(const std::string& path, const std::string& key)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+
+	char magic[sizeof(tableMagic)];
+	uint32_t version = 0;
+	uint32_t keyLength = 0;
+	file.read(magic, sizeof(magic));
+	file.read((char*)&version, sizeof(version));
+	file.read((char*)&keyLength, sizeof(keyLength));
+	if (!file || memcmp(magic, tableMagic, sizeof(magic)) != 0 || version != tableVersion || keyLength != key.size())
+		return false;
+
+	// stale once the firmware or the parameters differ, e.g. after setIrCameraParams with a calibration
+	std::string fileKey(keyLength, '\0');
+	libfreenect2::Freenect2Device::IrCameraParams fileDepthParams;
+	libfreenect2::Freenect2Device::ColorCameraParams fileColorParams;
+	file.read(&fileKey[0], keyLength);
+	file.read((char*)&fileDepthParams, sizeof(fileDepthParams));
+	file.read((char*)&fileColorParams, sizeof(fileColorParams));
+	if (!file || fileKey != key ||
+		memcmp(&fileDepthParams, &depthParams, sizeof(depthParams)) != 0 ||
+		memcmp(&fileColorParams, &colorParams, sizeof(colorParams)) != 0)
+		return false;
+
+	file.read((char*)distortIndex.data(), distortIndex.size() * sizeof(int));
+	file.read((char*)colorX.data(), colorX.size() * sizeof(float));
+	file.read((char*)colorRow.data(), colorRow.size() * sizeof(float));
+	if (!file)
+		return false;
+
+	// the frame loop indexes the depth frame with distortIndex and the color frame with colorY * width unchecked, a
+	// damaged file must not reach it. built tables keep colorX, the normalized color x, around +-1 and the color row
+	// within a few hundred rows of the image
+	const int numPixels = DEPTH_WIDTH * DEPTH_HEIGHT;
+	for (int i = 0; i < numPixels; i++)
+	{
+		if (distortIndex[i] < -1 || distortIndex[i] >= numPixels ||
+			!(std::abs(colorX[i]) <= 100.0f) ||
+			!(colorRow[i] >= -COLOR_HEIGHT && colorRow[i] < COLOR_HEIGHT * 2))
+			return false;
+	}
+	return true;
+}
+
+//--------------------------------------------------------------------------------
+bool ofxKinectV2Registration::saveTables(const std::string& path, const std::string& key) const
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+		return false;
+
+	const uint32_t keyLength = (uint32_t)key.size();
+	file.write(tableMagic, sizeof(tableMagic));
+	file.write((const char*)&tableVersion, sizeof(tableVersion));
+	file.write((const char*)&keyLength, sizeof(keyLength));
+	file.write(key.data(), keyLength);
+	file.write((const char*)&depthParams, sizeof(depthParams));
+	file.write((const char*)&colorParams, sizeof(colorParams));
+	file.write((const char*)distortIndex.data(), distortIndex.size() * sizeof(int));
+	file.write((const char*)colorX.data(), colorX.size() * sizeof(float));
+	file.write((const char*)colorRow.data(), colorRow.size() * sizeof(float));
+	return (bool)file;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2Registration::setColorScale(int scale)
+{
+	if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+		return;
+	colorScale = scale;
+	colorWidth = COLOR_WIDTH / scale;
+	colorHeight = COLOR_HEIGHT / scale;
+	filterHeight = colorHeight + FILTER_HEIGHT_HALF * 2;
+	filterMap.resize(colorWidth * filterHeight);
+
+	// band of every z buffer row
+	std::vector<int> rowBand(filterHeight);
+	for (int band = 0; band < FILTER_BANDS; band++)
+	{
+		for (int row = filterHeight * band / FILTER_BANDS; row < filterHeight * (band + 1) / FILTER_BANDS; row++)
+			rowBand[row] = band;
+	}
+
+	bandPixels.assign(FILTER_BANDS, std::vector<int>());
+	for (int i = 0; i < DEPTH_WIDTH * DEPTH_HEIGHT; i++)
+	{
+		// a small pixel covers scale full pixels, each of those rounds from half a pixel before it
+		colorY[i] = (int)((colorRow[i] + 0.5f) / scale);
+
+		if (distortIndex[i] < 0)
+			continue;
+
+		// the window covers z buffer rows colorY to colorY + 2, one more on each side lets the color x
+		// wrap into the neighbouring row anywhere within a row width of the image
+		const int first = std::max(colorY[i] - 1, 0);
+		const int last = std::min(colorY[i] + 3, filterHeight - 1);
+		if (first > last)
+			continue;
+		for (int band = rowBand[first]; band <= rowBand[last]; band++)
+			bandPixels[band].push_back(i);
+	}
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2Registration::distort(int mx, int my, float& x, float& y) const
+{
+	// radial and tangential lens distortion of the ir camera
+	float dx = ((float)mx - depthParams.cx) / depthParams.fx;
+	float dy = ((float)my - depthParams.cy) / depthParams.fy;
+	float dx2 = dx * dx;
+	float dy2 = dy * dy;
+	float r2 = dx2 + dy2;
+	float dxdy2 = 2 * dx * dy;
+	float kr = 1 + ((depthParams.k3 * r2 + depthParams.k2) * r2 + depthParams.k1) * r2;
+	x = depthParams.fx * (dx * kr + depthParams.p2 * (r2 + 2 * dx2) + depthParams.p1 * dxdy2) + depthParams.cx;
+	y = depthParams.fy * (dy * kr + depthParams.p1 * (r2 + 2 * dy2) + depthParams.p2 * dxdy2) + depthParams.cy;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2Registration::depthToColor(float mx, float my, float& rx, float& ry) const
+{
+	mx = (mx - depthParams.cx) * depthQ;
+	my = (my - depthParams.cy) * depthQ;
+
+	const auto& c = colorParams;
+	float wx =
+		(mx * mx * mx * c.mx_x3y0) + (my * my * my * c.mx_x0y3) +
+		(mx * mx * my * c.mx_x2y1) + (my * my * mx * c.mx_x1y2) +
+		(mx * mx * c.mx_x2y0) + (my * my * c.mx_x0y2) + (mx * my * c.mx_x1y1) +
+		(mx * c.mx_x1y0) + (my * c.mx_x0y1) + (c.mx_x0y0);
+
+	float wy =
+		(mx * mx * mx * c.my_x3y0) + (my * my * my * c.my_x0y3) +
+		(mx * mx * my * c.my_x2y1) + (my * my * mx * c.my_x1y2) +
+		(mx * mx * c.my_x2y0) + (my * my * c.my_x0y2) + (mx * my * c.my_x1y1) +
+		(mx * c.my_x1y0) + (my * c.my_x0y1) + (c.my_x0y0);
+
+	rx = (wx / (c.fx * colorQ)) - (c.shift_m / c.shift_d);
+	ry = (wy / colorQ) + c.cy;
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2Registration::apply(const libfreenect2::Frame* rgb, const libfreenect2::Frame* depth,
+	libfreenect2::Frame* undistorted, libfreenect2::Frame* registered, ofxKinectV2Kernels::ThreadPool& pool, bool enableFilter,
+	libfreenect2::Frame* bigdepth)
+{
+	// same checks as libfreenect2, nothing is written for frames of another size
+	if (!rgb || !depth || !undistorted || !registered ||
+		(int)rgb->width != colorWidth || (int)rgb->height != colorHeight || rgb->bytes_per_pixel != 4 ||
+		depth->width != DEPTH_WIDTH || depth->height != DEPTH_HEIGHT || depth->bytes_per_pixel != 4 ||
+		undistorted->width != DEPTH_WIDTH || undistorted->height != DEPTH_HEIGHT || undistorted->bytes_per_pixel != 4 ||
+		registered->width != DEPTH_WIDTH || registered->height != DEPTH_HEIGHT || registered->bytes_per_pixel != 4)
+		return;
+	if (bigdepth && ((int)bigdepth->width != colorWidth || (int)bigdepth->height != filterHeight || bigdepth->bytes_per_pixel != 4))
+		bigdepth = nullptr;
+
+	const float* depthData = (const float*)depth->data;
+	const uint32_t* rgbData = (const uint32_t*)rgb->data;
+	float* undistortedData = (float*)undistorted->data;
+	uint32_t* registeredData = (uint32_t*)registered->data;
+
+	const float shiftM = colorParams.shift_m;
+	// 0.5f added for the rounding below, both divide out to the original at scale 1
+	const float fx = colorParams.fx / colorScale;
+	const float colorCx = (colorParams.cx + 0.5f) / colorScale;
+	const int width = colorWidth;
+	const int sizeColor = colorWidth * colorHeight;
+
+	// undistorted depth and the color pixel each depth pixel lands on
+	pool.parallelFor(DEPTH_HEIGHT, [&](size_t rowBegin, size_t rowEnd)
+	{
+		for (size_t i = rowBegin * DEPTH_WIDTH; i < rowEnd * DEPTH_WIDTH; i++)
+		{
+			const int index = distortIndex[i];
+			if (index < 0)
+			{
+				colorOffset[i] = -1;
+				undistortedData[i] = 0;
+				continue;
+			}
+
+			const float z = depthData[index];
+			undistortedData[i] = z;
+			if (z <= 0.0f)
+			{
+				colorOffset[i] = -1;
+				continue;
+			}
+
+			const float rx = (colorX[i] + (shiftM / z)) * fx + colorCx;
+			const int cx = rx; // same as round for positive numbers
+			const int offset = cx + colorY[i] * width;
+			colorOffset[i] = offset < 0 || offset >= sizeColor ? -1 : offset;
+		}
+	});
+
+	if (!enableFilter)
+	{
+		pool.parallelFor(DEPTH_HEIGHT, [&](size_t rowBegin, size_t rowEnd)
+		{
+			for (size_t i = rowBegin * DEPTH_WIDTH; i < rowEnd * DEPTH_WIDTH; i++)
+			{
+				const int offset = colorOffset[i];
+				registeredData[i] = offset < 0 ? 0 : rgbData[offset];
+			}
+		});
+		return;
+	}
+
+	// nearest z around every color pixel. each band only writes its own rows, and a minimum
+	// doesn't depend on the order, so this matches the serial z buffer without merging per thread copies
+	float* zBuffer = bigdepth ? (float*)bigdepth->data : filterMap.data();
+	pool.parallelFor(FILTER_BANDS, [&](size_t begin, size_t end)
+	{
+		for (size_t band = begin; band < end; band++)
+		{
+			const int first = filterHeight * (int)band / FILTER_BANDS * width;
+			const int last = filterHeight * ((int)band + 1) / FILTER_BANDS * width;
+			std::fill(zBuffer + first, zBuffer + last, std::numeric_limits<float>::infinity());
+
+			for (int i : bandPixels[band])
+			{
+				const int offset = colorOffset[i];
+				if (offset < 0)
+					continue;
+				const float z = undistortedData[i];
+				for (int r = 0; r <= FILTER_HEIGHT_HALF * 2; r++)
+				{
+					const int from = std::max(offset + r * width - FILTER_WIDTH_HALF, first);
+					const int to = std::min(offset + r * width + FILTER_WIDTH_HALF + 1, last);
+					for (int j = from; j < to; j++)
+					{
+						if (z < zBuffer[j]) zBuffer[j] = z;
+					}
+				}
+			}
+		}
+	});
+
+	// colors of surfaces hidden behind a closer one are dropped
+	const float* nearest = zBuffer + FILTER_HEIGHT_HALF * width;
+	pool.parallelFor(DEPTH_HEIGHT, [&](size_t rowBegin, size_t rowEnd)
+	{
+		for (size_t i = rowBegin * DEPTH_WIDTH; i < rowEnd * DEPTH_WIDTH; i++)
+		{
+			const int offset = colorOffset[i];
+			if (offset < 0)
+			{
+				registeredData[i] = 0;
+				continue;
+			}
+			const float minZ = nearest[offset];
+			const float z = undistortedData[i];
+			registeredData[i] = (z - minZ) / z > filterTolerance ? 0 : rgbData[offset];
+		}
+	});
+}
+
+//--------------------------------------------------------------------------------
+void ofxKinectV2Registration::undistortDepth(const libfreenect2::Frame* depth, libfreenect2::Frame* undistorted,
+	ofxKinectV2Kernels::ThreadPool& pool)
+{
+	if (!depth || !undistorted ||
+		depth->width != DEPTH_WIDTH || depth->height != DEPTH_HEIGHT || depth->bytes_per_pixel != 4 ||
+		undistorted->width != DEPTH_WIDTH || undistorted->height != DEPTH_HEIGHT || undistorted->bytes_per_pixel != 4)
+		return;
+
+	const float* depthData = (const float*)depth->data;
+	float* undistortedData = (float*)undistorted->data;
+	pool.parallelFor(DEPTH_HEIGHT, [&](size_t rowBegin, size_t rowEnd)
+	{
+		for (size_t i = rowBegin * DEPTH_WIDTH; i < rowEnd * DEPTH_WIDTH; i++)
+		{
+			const int index = distortIndex[i];
+			undistortedData[i] = index < 0 ? 0 : depthData[index];
+		}
+	});
+}
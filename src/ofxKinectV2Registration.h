@@ -0,0 +1,84 @@
+//
+//  ofxKinectV2Registration.h
+//  kinectExample
+//
+//  libfreenect2::Registration::apply and undistortDepth split into row bands
+//  on a ThreadPool. The distortion and depth to color tables are built once
+//  from the camera parameters the same way libfreenect2 does, so the frame
+//  loop only adds the depth dependent shift and gathers, with identical results.
+//
+
+#pragma once
+
+#include <libfreenect2/libfreenect2.hpp>
+#include <libfreenect2/frame_listener.hpp>
+#include "ofxKinectV2Kernels.h"
+
+class ofxKinectV2Registration {
+public:
+	// with a cachePath the per pixel tables are read from that file if it was written for the same key (e.g. serial
+	// and firmware) and camera parameters, otherwise they are built and the file is written
+	ofxKinectV2Registration(const libfreenect2::Freenect2Device::IrCameraParams& depthParams,
+		const libfreenect2::Freenect2Device::ColorCameraParams& colorParams,
+		const std::string& cachePath = "", const std::string& cacheKey = "");
+
+	// true if the constructor found usable tables in the cache
+	bool isFromCache() const { return bTablesCached; }
+
+	// same frames and results as libfreenect2::Registration::apply without color_depth_map. with the filter
+	// enabled the z buffer lands in bigdepth if given: 1920x1082 floats at scale 1, mm of the nearest depth pixel around
+	// each color pixel or infinity, color row y in row y + 1
+	void apply(const libfreenect2::Frame* rgb, const libfreenect2::Frame* depth, libfreenect2::Frame* undistorted,
+		libfreenect2::Frame* registered, ofxKinectV2Kernels::ThreadPool& pool, bool enableFilter = true,
+		libfreenect2::Frame* bigdepth = nullptr);
+	void undistortDepth(const libfreenect2::Frame* depth, libfreenect2::Frame* undistorted, ofxKinectV2Kernels::ThreadPool& pool);
+
+	// color frames reduced by 1, 2, 4 or 8 in each direction: apply() then expects rgb and bigdepth of
+	// getColorWidth() x getColorHeight() (+ 2 rows), other values are ignored. not thread safe against apply()
+	void setColorScale(int scale);
+	int getColorScale() const { return colorScale; }
+	int getColorWidth() const { return colorWidth; }
+	int getColorHeight() const { return colorHeight; }
+
+	static const int DEPTH_WIDTH = 512;
+	static const int DEPTH_HEIGHT = 424;
+	static const int COLOR_WIDTH = 1920;
+	static const int COLOR_HEIGHT = 1080;
+	// z buffer window around each color pixel, as in libfreenect2. in color pixels of the current scale
+	static const int FILTER_WIDTH_HALF = 2;
+	static const int FILTER_HEIGHT_HALF = 1;
+	static const int FILTER_HEIGHT = COLOR_HEIGHT + FILTER_HEIGHT_HALF * 2;
+
+private:
+	// color rows of the z buffer are split into this many bands, each owned by one task
+	static const int FILTER_BANDS = 32;
+
+	void buildTables();
+	bool loadTables(const std::string& path, const std::string& key);
+	bool saveTables(const std::string& path, const std::string& key) const;
+	void distort(int mx, int my, float& x, float& y) const;
+	void depthToColor(float mx, float my, float& rx, float& ry) const;
+
+	libfreenect2::Freenect2Device::IrCameraParams depthParams;
+	libfreenect2::Freenect2Device::ColorCameraParams colorParams;
+
+	bool bTablesCached = false;
+	int colorScale = 1;
+	int colorWidth = COLOR_WIDTH;
+	int colorHeight = COLOR_HEIGHT;
+	int filterHeight = FILTER_HEIGHT;
+
+	// per depth pixel: source pixel of the undistorted depth or -1, color x before the depth shift,
+	// full resolution color y and the color row at the current scale
+	std::vector<int> distortIndex;
+	std::vector<float> colorX;
+	std::vector<float> colorRow;
+	std::vector<int> colorY;
+
+	// depth pixels whose z buffer window may reach into each band, from colorY with a row of margin
+	std::vector<std::vector<int> > bandPixels;
+
+	// per frame: color offset of each depth pixel or -1, and the z buffer with FILTER_HEIGHT_HALF rows above and below
+	std::vector<int> colorOffset;
+	std::vector<float> filterMap;
+};